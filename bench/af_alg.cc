@@ -0,0 +1,146 @@
+/*
+
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+// Throughput of af_alg::hasher against the in-library engines, to pick a
+// backend per input size:
+//
+//   library  Hasher::update on a buffer in memory
+//   kernel   af_alg::hasher::update on the same buffer (send)
+//   lib fd   pread into a buffer, then Hasher::update
+//   splice   af_alg::hasher::splice_from on the file, no user space copy
+//
+// Every digest includes constructing its hasher, which for the kernel
+// backend means opening the AF_ALG sockets; that is what a caller hashing
+// one buffer pays. The file is read from the page cache.
+//
+// Usage: af_alg [sha256|sha512|blake2b] [scratch file]
+
+#include "af_alg.hh"
+#include "blake2b.hh"
+#include "detail.hh"
+#include "sha256.hh"
+#include "sha512.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+  volatile uint8_t sink;
+
+  // Runs f until at least 0.2 s have passed; returns MB/s for `bytes` per
+  // call.
+  template <typename F>
+  double throughput(size_t bytes, F && f)
+  {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    uint64_t calls = 0;
+    double elapsed;
+    do
+      {
+        f();
+        calls++;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+      }
+    while (elapsed < 0.2);
+    return double(bytes) * calls / elapsed / 1e6;
+  }
+
+  template <typename Hasher>
+  void run(char const * name, char const * path)
+  {
+    static size_t const sizes[] = { 64, 1024, 16 << 10, 256 << 10, 4 << 20, 64 << 20 };
+    size_t const largest = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+
+    std::vector<uint8_t> data(largest);
+    for (size_t i = 0; i < data.size(); i++) data[i] = uint8_t(i * 131 + (i >> 11));
+
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+      {
+        std::perror(path);
+        return;
+      }
+    ::unlink(path);
+    iev::detail::write_fully(fd, data.data(), data.size(), 0);
+
+    bool kernel = iev::af_alg::available<Hasher>();
+    std::printf("%s, AF_ALG %s\n", name, kernel ? "available" : "not available, kernel columns use the fallback");
+    std::printf("%10s %12s %12s %12s %12s   (MB/s)\n", "bytes", "library", "kernel", "lib fd", "splice");
+
+    std::vector<uint8_t> buf(64 * 1024);
+    for (size_t n : sizes)
+      {
+        double library = throughput(n, [&]()
+          {
+            Hasher h;
+            h.update(data.data(), n);
+            sink = *h.finalize().begin();
+          });
+
+        double kernel_mem = throughput(n, [&]()
+          {
+            iev::af_alg::hasher<Hasher> h;
+            h.update(data.data(), n);
+            sink = *h.finalize().begin();
+          });
+
+        double library_fd = throughput(n, [&]()
+          {
+            Hasher h;
+            for (size_t done = 0; done < n; )
+              {
+                size_t want = std::min(buf.size(), n - done);
+                iev::detail::read_fully(fd, buf.data(), want, done);
+                h.update(buf.data(), want);
+                done += want;
+              }
+            sink = *h.finalize().begin();
+          });
+
+        double kernel_splice = throughput(n, [&]()
+          {
+            iev::af_alg::hasher<Hasher> h;
+            loff_t offset = 0;
+            h.splice_from(fd, n, &offset);
+            sink = *h.finalize().begin();
+          });
+
+        std::printf("%10zu %12.1f %12.1f %12.1f %12.1f\n", n, library, kernel_mem, library_fd, kernel_splice);
+      }
+    std::printf("\n");
+    ::close(fd);
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  std::string algorithm = argc > 1 ? argv[1] : "all";
+  char const * path = argc > 2 ? argv[2] : "af_alg.bench.tmp";
+
+  if (::sodium_init() < 0)
+    {
+      std::fprintf(stderr, "libsodium failed to initialize\n");
+      return 1;
+    }
+
+  if (algorithm == "all" || algorithm == "sha256") run<iev::sha256::incremental_hasher>("sha256", path);
+  if (algorithm == "all" || algorithm == "sha512") run<iev::sha512::incremental_hasher>("sha512", path);
+  if (algorithm == "all" || algorithm == "blake2b") run<iev::blake2b<512>::incremental_hasher>("blake2b-512", path);
+  return 0;
+}
@@ -0,0 +1,326 @@
+/*
+
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef IEV_HASH_AF_ALG_HH
+#define IEV_HASH_AF_ALG_HH
+
+#include "detail.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <inttypes.h>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/if_alg.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace iev
+{
+  namespace sha256 { class sum; }
+  class sha512;
+  template <size_t N> class blake2b;
+
+  // Linux kernel crypto (AF_ALG) hashing.
+  //
+  // af_alg::hasher<Hasher> has the same update/finalize interface as the
+  // in-library incremental hasher it wraps and returns the same digest type,
+  // but feeds the data to the kernel's hash socket instead. When AF_ALG or the
+  // algorithm is not available it silently uses Hasher itself.
+  //
+  // The gain is on data that is already in the kernel: splice() moves page
+  // references from a file or pipe into the hash socket without copying the
+  // bytes through user space. Each hasher opens two sockets and each
+  // update() is a send(), so that fixed cost has to be won back by the size
+  // of the input; bench/af_alg.cc measures where that happens on a given
+  // machine and kernel.
+  namespace af_alg
+  {
+    template <typename Digest>
+    struct kernel_name;
+
+    template <>
+    struct kernel_name<sha256::sum>
+    {
+      static constexpr char const * value = "sha256";
+    };
+
+    template <>
+    struct kernel_name<sha512>
+    {
+      static constexpr char const * value = "sha512";
+    };
+
+    template <>
+    struct kernel_name<blake2b<160>>
+    {
+      static constexpr char const * value = "blake2b-160";
+    };
+
+    template <>
+    struct kernel_name<blake2b<256>>
+    {
+      static constexpr char const * value = "blake2b-256";
+    };
+
+    template <>
+    struct kernel_name<blake2b<384>>
+    {
+      static constexpr char const * value = "blake2b-384";
+    };
+
+    template <>
+    struct kernel_name<blake2b<512>>
+    {
+      static constexpr char const * value = "blake2b-512";
+    };
+
+
+    template <typename Hasher>
+    class hasher
+    {
+    public:
+      using digest_type = detail::digest_of<Hasher>;
+
+    private:
+      int tfm_;
+      int op_;
+      Hasher fallback_;
+
+      // Opens the transform and an operation socket for it. Leaves both at -1
+      // if the kernel does not offer AF_ALG or this algorithm.
+      void open_kernel() noexcept
+      {
+        tfm_ = ::socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (tfm_ < 0) return;
+
+        struct sockaddr_alg sa;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.salg_family = AF_ALG;
+        std::strcpy(reinterpret_cast<char *>(sa.salg_type), "hash");
+        std::strncpy(reinterpret_cast<char *>(sa.salg_name), kernel_name<digest_type>::value, sizeof(sa.salg_name) - 1);
+
+        if (::bind(tfm_, reinterpret_cast<struct sockaddr *>(&sa), sizeof(sa)) == 0)
+          {
+            op_ = ::accept4(tfm_, nullptr, nullptr, SOCK_CLOEXEC);
+          }
+
+        if (op_ < 0)
+          {
+            ::close(tfm_);
+            tfm_ = -1;
+          }
+      }
+
+      void close_kernel() noexcept
+      {
+        if (op_ >= 0) ::close(op_);
+        if (tfm_ >= 0) ::close(tfm_);
+        op_ = -1;
+        tfm_ = -1;
+      }
+
+      void fallback_read(int fd, size_t len, loff_t * offset)
+      {
+        uint8_t buf[64 * 1024];
+        while (len != 0)
+          {
+            size_t want = std::min(len, sizeof(buf));
+            ssize_t r = offset ? ::pread(fd, buf, want, *offset) : ::read(fd, buf, want);
+            if (r < 0)
+              {
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::system_category(), "read");
+              }
+            if (r == 0) throw std::system_error(EIO, std::system_category(), "unexpected end of file");
+            fallback_.update(buf, r);
+            if (offset) *offset += r;
+            len -= r;
+          }
+      }
+
+      // Moves len bytes from a pipe into the operation socket.
+      void splice_pipe(int pipe, size_t len)
+      {
+        while (len != 0)
+          {
+            ssize_t r = ::splice(pipe, nullptr, op_, nullptr, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (r < 0)
+              {
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::system_category(), "splice");
+              }
+            if (r == 0) throw std::system_error(EIO, std::system_category(), "unexpected end of pipe");
+            len -= r;
+          }
+      }
+
+    public:
+
+      hasher() noexcept
+        : tfm_(-1), op_(-1)
+      {
+        open_kernel();
+      }
+
+      hasher(hasher const &) = delete;
+      hasher & operator=(hasher const &) = delete;
+
+      hasher(hasher && other) noexcept
+        : tfm_(other.tfm_), op_(other.op_), fallback_(std::move(other.fallback_))
+      {
+        other.tfm_ = -1;
+        other.op_ = -1;
+      }
+
+      hasher & operator=(hasher && other) noexcept
+      {
+        if (this != &other)
+          {
+            close_kernel();
+            std::swap(tfm_, other.tfm_);
+            std::swap(op_, other.op_);
+            fallback_ = std::move(other.fallback_);
+          }
+        return *this;
+      }
+
+      ~hasher()
+      {
+        close_kernel();
+      }
+
+      // True if data is being hashed by the kernel.
+      bool offloaded() const noexcept
+      {
+        return op_ >= 0;
+      }
+
+      void update(uint8_t const * data, size_t datalen)
+      {
+        if (!offloaded())
+          {
+            fallback_.update(data, datalen);
+            return;
+          }
+
+        while (datalen != 0)
+          {
+            ssize_t r = ::send(op_, data, datalen, MSG_MORE);
+            if (r < 0)
+              {
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::system_category(), "send");
+              }
+            data += r;
+            datalen -= r;
+          }
+      }
+
+      // Hashes len bytes read from fd. With a non-null offset the data is read
+      // at *offset, which is advanced, and the file position is unchanged
+      // (as with pread); otherwise it is read from the current position.
+      //
+      // Pipes are spliced straight into the hash socket. Other descriptors
+      // are spliced through an internal pipe, which only moves page
+      // references, so the data is never copied into user space.
+      void splice_from(int fd, size_t len, loff_t * offset = nullptr)
+      {
+        if (!offloaded())
+          {
+            fallback_read(fd, len, offset);
+            return;
+          }
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) && offset == nullptr)
+          {
+            splice_pipe(fd, len);
+            return;
+          }
+
+        int p[2];
+        if (::pipe2(p, O_CLOEXEC) != 0) throw std::system_error(errno, std::system_category(), "pipe2");
+
+        try
+          {
+            while (len != 0)
+              {
+                ssize_t r = ::splice(fd, offset, p[1], nullptr, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (r < 0)
+                  {
+                    if (errno == EINTR) continue;
+                    throw std::system_error(errno, std::system_category(), "splice");
+                  }
+                if (r == 0) throw std::system_error(EIO, std::system_category(), "unexpected end of file");
+                splice_pipe(p[0], r);
+                len -= r;
+              }
+          }
+        catch (...)
+          {
+            ::close(p[0]);
+            ::close(p[1]);
+            throw;
+          }
+
+        ::close(p[0]);
+        ::close(p[1]);
+      }
+
+      // Returns the digest and resets the hasher for reuse.
+      digest_type finalize()
+      {
+        if (!offloaded())
+          {
+            digest_type out = fallback_.finalize();
+            fallback_ = Hasher();
+            return out;
+          }
+
+        digest_type out;
+        while (::send(op_, nullptr, 0, 0) < 0)
+          {
+            if (errno != EINTR) throw std::system_error(errno, std::system_category(), "send");
+          }
+
+        uint8_t * p = &*out.begin();
+        size_t n = out.size();
+        while (n != 0)
+          {
+            ssize_t r = ::read(op_, p, n);
+            if (r < 0)
+              {
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::system_category(), "read");
+              }
+            if (r == 0) throw std::system_error(EIO, std::system_category(), "short digest");
+            p += r;
+            n -= r;
+          }
+
+        return out;
+      }
+    };
+
+    // True if the running kernel can hash Hasher's algorithm through AF_ALG.
+    template <typename Hasher>
+    bool available() noexcept
+    {
+      return hasher<Hasher>().offloaded();
+    }
+  }
+}
+
+#endif
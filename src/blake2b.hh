@@ -49,7 +49,12 @@ namespace iev
       ::crypto_generichash_blake2b_state private_state;
 
     public:
+      static constexpr size_t block_size = 128;
 
+      incremental_hasher()
+        : incremental_hasher(nullptr, 0)
+      {
+      }
 
       incremental_hasher(uint8_t const * key, size_t keylen)
       {
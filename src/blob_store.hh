@@ -0,0 +1,842 @@
+/*
+
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef IEV_HASH_BLOB_STORE_HH
+#define IEV_HASH_BLOB_STORE_HH
+
+#include "copy_hash.hh"
+#include "detail.hh"
+#include "parallel.hh"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <inttypes.h>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace iev
+{
+  // Local content addressable blob store.
+  //
+  // Blobs are keyed by their digest under Hasher (e.g.
+  // sha256::incremental_hasher for sha256::sum keys, or
+  // blake2b<256>::incremental_hasher for blake2b<256> keys) and appended to
+  // packfiles in a directory, so small blobs do not each cost a file.
+  //
+  // pack-<seq>.pack, all integers little endian:
+  //
+  //    0  magic "IEVPACK1"
+  //    8  u32 key size
+  //   12  u32 reserved, zero
+  //   16  records: u64 length, data, key
+  //
+  // The key trails the data so a blob can be streamed in and hashed on the
+  // way. Once a pack reaches its size limit it is sealed by writing
+  // pack-<seq>.idx next to it and is never modified again:
+  //
+  //    0  magic "IEVPIDX1"
+  //    8  u32 key size
+  //   12  u32 reserved, zero
+  //   16  u64 entry count
+  //   24  u32 fanout[256]: entries whose key's first byte is <= i
+  //   1048  entries sorted by key: key, u64 data offset, u64 length
+  //
+  // Index files are mapped, so finding a blob in a sealed pack is a fanout
+  // lookup and a short binary search in memory, then one pread. The unsealed
+  // pack is indexed in memory and rescanned (and verified) on open; a torn
+  // record at its tail is truncated away.
+  //
+  // A directory is used by one blob_store object at a time: opening it takes
+  // an exclusive flock on <dir>/lock, waiting for any other holder, in this
+  // process or another. All members are safe to call from several threads.
+  template <typename Hasher>
+  class blob_store
+  {
+  public:
+    using key_type = detail::digest_of<Hasher>;
+
+    static constexpr size_t key_size = sizeof(key_type);
+
+    struct blob
+    {
+      uint8_t const * data;
+      size_t length;
+    };
+
+  private:
+    using key_bytes = std::array<uint8_t, key_size>;
+
+    static constexpr char pack_magic[8] = { 'I', 'E', 'V', 'P', 'A', 'C', 'K', '1' };
+    static constexpr char index_magic[8] = { 'I', 'E', 'V', 'P', 'I', 'D', 'X', '1' };
+    static constexpr size_t pack_header_size = 16;
+    static constexpr size_t index_header_size = 24 + 256 * 4;
+    static constexpr size_t entry_size = key_size + 16;
+
+    struct location
+    {
+      uint64_t offset;
+      uint64_t length;
+    };
+
+    struct key_hash
+    {
+      size_t operator()(key_bytes const & k) const noexcept
+      {
+        // Keys are digests, so any of their bytes are already well mixed.
+        size_t h;
+        std::memcpy(&h, k.data(), std::min(sizeof(h), key_size));
+        return h;
+      }
+    };
+
+    static key_bytes to_bytes(key_type const & key)
+    {
+      key_bytes k;
+      std::copy(key.begin(), key.end(), k.begin());
+      return k;
+    }
+
+    static key_type from_bytes(uint8_t const * k)
+    {
+      key_type key;
+      std::copy(k, k + key_size, key.begin());
+      return key;
+    }
+
+    // Sink for hashing_writer that appends at a moving offset.
+    struct pack_sink
+    {
+      int fd;
+      uint64_t offset;
+
+      void operator()(uint8_t const * data, size_t len)
+      {
+        detail::write_fully(fd, data, len, offset);
+        offset += len;
+      }
+    };
+
+    // An unnamed file in the store directory that one put(int) streams its
+    // record into. Being on the pack's filesystem lets the record be copied
+    // into the pack inside the kernel.
+    class staging_file
+    {
+    public:
+      int fd;
+
+      explicit staging_file(std::string const & dir)
+      {
+        fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (fd >= 0) return;
+
+        // No O_TMPFILE on this filesystem: a named file, unlinked at once.
+        std::string path = dir + "/staging-XXXXXX";
+        fd = ::mkostemp(&path[0], O_CLOEXEC);
+        if (fd < 0) throw std::system_error(errno, std::system_category(), path);
+        ::unlink(path.c_str());
+      }
+
+      staging_file(staging_file const &) = delete;
+      staging_file & operator=(staging_file const &) = delete;
+
+      ~staging_file()
+      {
+        ::close(fd);
+      }
+    };
+
+    // A sealed pack and its mapped index.
+    class sealed_pack
+    {
+    public:
+      uint64_t seq;
+      int fd;
+      void * map;
+      size_t map_length;
+
+      sealed_pack(uint64_t s, int pack_fd, void * index_map, size_t index_length) noexcept
+        : seq(s), fd(pack_fd), map(index_map), map_length(index_length)
+      {
+      }
+
+      sealed_pack(sealed_pack const &) = delete;
+      sealed_pack & operator=(sealed_pack const &) = delete;
+
+      ~sealed_pack()
+      {
+        ::munmap(map, map_length);
+        ::close(fd);
+      }
+
+      uint8_t const * base() const noexcept { return static_cast<uint8_t const *>(map); }
+      uint64_t count() const noexcept { return detail::load_littleendian64(base() + 16); }
+      uint8_t const * entry(uint64_t i) const noexcept { return base() + index_header_size + i * entry_size; }
+
+      bool find(key_bytes const & k, location & out) const noexcept
+      {
+        uint8_t const * fanout = base() + 24;
+        uint64_t lo = k[0] == 0 ? 0 : detail::load_littleendian32(fanout + 4 * (k[0] - 1));
+        uint64_t hi = detail::load_littleendian32(fanout + 4 * k[0]);
+
+        while (lo < hi)
+          {
+            uint64_t mid = lo + (hi - lo) / 2;
+            int c = std::memcmp(entry(mid), k.data(), key_size);
+            if (c == 0)
+              {
+                out.offset = detail::load_littleendian64(entry(mid) + key_size);
+                out.length = detail::load_littleendian64(entry(mid) + key_size + 8);
+                return true;
+              }
+            if (c < 0) lo = mid + 1;
+            else hi = mid;
+          }
+        return false;
+      }
+    };
+
+    std::string dir_;
+    uint64_t pack_limit_;
+    int lock_fd_;
+
+    // Searched last to first. The order only decides which copy of a
+    // duplicated blob is read.
+    std::vector<std::shared_ptr<sealed_pack>> sealed_;
+
+    int active_fd_;
+    uint64_t active_seq_;
+    uint64_t active_end_;
+    std::unordered_map<key_bytes, location, key_hash> active_index_;
+    uint64_t next_seq_;
+
+    mutable std::shared_mutex lock_;
+    std::mutex compact_lock_;
+
+    std::mutex background_lock_;
+    std::future<void> background_;
+
+    std::string pack_path(uint64_t seq, char const * ext) const
+    {
+      char name[64];
+      std::snprintf(name, sizeof(name), "/pack-%016" PRIx64 ".%s", seq, ext);
+      return dir_ + name;
+    }
+
+    static void sync_fd(int fd, std::string const & path)
+    {
+      if (::fsync(fd) != 0) throw std::system_error(errno, std::system_category(), path);
+    }
+
+    void sync_dir() const
+    {
+      int fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd < 0) throw std::system_error(errno, std::system_category(), dir_);
+      ::fsync(fd);
+      ::close(fd);
+    }
+
+    int open_pack(uint64_t seq, bool create)
+    {
+      std::string path = pack_path(seq, "pack");
+      int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+      if (fd < 0) throw std::system_error(errno, std::system_category(), path);
+
+      if (create)
+        {
+          uint8_t header[pack_header_size] = {};
+          std::memcpy(header, pack_magic, sizeof(pack_magic));
+          detail::store_littleendian32(header + 8, key_size);
+          try
+            {
+              detail::write_fully(fd, header, sizeof(header), 0);
+            }
+          catch (...)
+            {
+              ::close(fd);
+              throw;
+            }
+        }
+      return fd;
+    }
+
+    // Reads every whole, intact record of a pack. Returns the offset just
+    // past the last good record.
+    static uint64_t scan_pack(int fd, std::unordered_map<key_bytes, location, key_hash> & index)
+    {
+      struct stat st;
+      if (::fstat(fd, &st) != 0) throw std::system_error(errno, std::system_category(), "fstat");
+      uint64_t size = st.st_size;
+
+      uint8_t header[pack_header_size];
+      if (size < pack_header_size) return 0;
+      detail::read_fully(fd, header, sizeof(header), 0);
+      if (std::memcmp(header, pack_magic, sizeof(pack_magic)) != 0 || detail::load_littleendian32(header + 8) != key_size)
+        {
+          throw std::system_error(EINVAL, std::system_category(), "iev::blob_store: not a pack for this key");
+        }
+
+      std::vector<uint8_t> buf(copy_hash_block);
+      uint64_t pos = pack_header_size;
+      while (pos + 8 + key_size <= size)
+        {
+          uint8_t len_bytes[8];
+          detail::read_fully(fd, len_bytes, 8, pos);
+          uint64_t len = detail::load_littleendian64(len_bytes);
+          if (len > size - pos - 8 - key_size) break;
+
+          Hasher h;
+          for (uint64_t done = 0; done < len; )
+            {
+              size_t n = std::min<uint64_t>(buf.size(), len - done);
+              detail::read_fully(fd, buf.data(), n, pos + 8 + done);
+              h.update(buf.data(), n);
+              done += n;
+            }
+
+          key_bytes stored;
+          detail::read_fully(fd, stored.data(), key_size, pos + 8 + len);
+          if (to_bytes(h.finalize()) != stored) break;
+
+          index.emplace(stored, location{ pos + 8, len });
+          pos += 8 + len + key_size;
+        }
+
+      return pos;
+    }
+
+    // Writes and renames the index for a pack. The pack must already be
+    // synced.
+    void write_index(uint64_t seq, std::vector<std::pair<key_bytes, location>> & entries)
+    {
+      std::sort(entries.begin(), entries.end(), [](auto const & a, auto const & b) { return a.first < b.first; });
+
+      std::vector<uint8_t> out(index_header_size + entries.size() * entry_size, 0);
+      std::memcpy(out.data(), index_magic, sizeof(index_magic));
+      detail::store_littleendian32(out.data() + 8, key_size);
+      detail::store_littleendian64(out.data() + 16, entries.size());
+
+      uint32_t counts[256] = {};
+      for (size_t i = 0; i < entries.size(); i++)
+        {
+          counts[entries[i].first[0]]++;
+          uint8_t * e = out.data() + index_header_size + i * entry_size;
+          std::memcpy(e, entries[i].first.data(), key_size);
+          detail::store_littleendian64(e + key_size, entries[i].second.offset);
+          detail::store_littleendian64(e + key_size + 8, entries[i].second.length);
+        }
+      for (uint32_t i = 0, total = 0; i < 256; i++)
+        {
+          total += counts[i];
+          detail::store_littleendian32(out.data() + 24 + 4 * i, total);
+        }
+
+      std::string path = pack_path(seq, "idx");
+      std::string tmp = path + ".tmp";
+      int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd < 0) throw std::system_error(errno, std::system_category(), tmp);
+      try
+        {
+          detail::write_fully(fd, out.data(), out.size(), 0);
+          sync_fd(fd, tmp);
+        }
+      catch (...)
+        {
+          ::close(fd);
+          ::unlink(tmp.c_str());
+          throw;
+        }
+      ::close(fd);
+
+      if (::rename(tmp.c_str(), path.c_str()) != 0)
+        {
+          int e = errno;
+          ::unlink(tmp.c_str());
+          throw std::system_error(e, std::system_category(), path);
+        }
+      sync_dir();
+    }
+
+    std::shared_ptr<sealed_pack> load_sealed(uint64_t seq)
+    {
+      std::string path = pack_path(seq, "idx");
+      int ifd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (ifd < 0) throw std::system_error(errno, std::system_category(), path);
+
+      struct stat st;
+      void * map = MAP_FAILED;
+      if (::fstat(ifd, &st) == 0 && uint64_t(st.st_size) >= index_header_size)
+        {
+          map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, ifd, 0);
+        }
+      ::close(ifd);
+
+      uint8_t const * base = static_cast<uint8_t const *>(map);
+      if (map == MAP_FAILED
+          || std::memcmp(base, index_magic, sizeof(index_magic)) != 0
+          || detail::load_littleendian32(base + 8) != key_size
+          || uint64_t(st.st_size) != index_header_size + detail::load_littleendian64(base + 16) * entry_size)
+        {
+          if (map != MAP_FAILED) ::munmap(map, st.st_size);
+          throw std::system_error(EINVAL, std::system_category(), path);
+        }
+
+      int fd;
+      try
+        {
+          fd = open_pack(seq, false);
+        }
+      catch (...)
+        {
+          ::munmap(map, st.st_size);
+          throw;
+        }
+      return std::make_shared<sealed_pack>(seq, fd, map, st.st_size);
+    }
+
+    void new_active_locked()
+    {
+      active_seq_ = next_seq_++;
+      active_fd_ = open_pack(active_seq_, true);
+      active_end_ = pack_header_size;
+      active_index_.clear();
+      sync_dir();
+    }
+
+    void seal_pack_locked()
+    {
+      sync_fd(active_fd_, pack_path(active_seq_, "pack"));
+
+      std::vector<std::pair<key_bytes, location>> entries(active_index_.begin(), active_index_.end());
+      write_index(active_seq_, entries);
+
+      ::close(active_fd_);
+      active_fd_ = -1;
+      active_index_.clear();
+      sealed_.push_back(load_sealed(active_seq_));
+    }
+
+    void seal_active_locked()
+    {
+      seal_pack_locked();
+      new_active_locked();
+    }
+
+    bool find_locked(key_bytes const & k, int & fd, location & loc) const
+    {
+      auto it = active_index_.find(k);
+      if (it != active_index_.end())
+        {
+          fd = active_fd_;
+          loc = it->second;
+          return true;
+        }
+
+      for (auto p = sealed_.rbegin(); p != sealed_.rend(); p++)
+        {
+          if ((*p)->find(k, loc))
+            {
+              fd = (*p)->fd;
+              return true;
+            }
+        }
+      return false;
+    }
+
+    // A record to append: u64 length, the caller's data, key.
+    struct pending_record
+    {
+      key_bytes key;
+      uint8_t const * data;
+      size_t length;
+    };
+
+    // Appends records to the active pack with pwritev straight from the
+    // callers' buffers, so the data is never staged in a copy, and indexes
+    // them.
+    void append_locked(pending_record const * records, size_t n)
+    {
+      constexpr size_t group = 64;
+      uint64_t end = active_end_;
+      for (size_t first = 0; first < n; first += group)
+        {
+          size_t count = std::min(group, n - first);
+          uint8_t lengths[group][8];
+          struct iovec iov[group * 3];
+          for (size_t i = 0; i < count; i++)
+            {
+              pending_record const & r = records[first + i];
+              detail::store_littleendian64(lengths[i], r.length);
+              iov[3 * i] = { lengths[i], 8 };
+              iov[3 * i + 1] = { const_cast<uint8_t *>(r.data), r.length };
+              iov[3 * i + 2] = { const_cast<uint8_t *>(r.key.data()), key_size };
+            }
+          detail::writev_fully(active_fd_, iov, count * 3, end);
+
+          for (size_t i = 0; i < count; i++)
+            {
+              pending_record const & r = records[first + i];
+              active_index_.emplace(r.key, location{ end + 8, r.length });
+              end += 8 + r.length + key_size;
+            }
+          active_end_ = end;
+        }
+      if (active_end_ >= pack_limit_) seal_active_locked();
+    }
+
+    // Reads the pack list, recovering the unsealed pack(s). Called with the
+    // directory lock held.
+    void load()
+    {
+      DIR * d = ::opendir(dir_.c_str());
+      if (!d) throw std::system_error(errno, std::system_category(), dir_);
+
+      std::vector<uint64_t> packs;
+      std::unordered_set<uint64_t> indexed;
+      while (struct dirent * e = ::readdir(d))
+        {
+          unsigned long long seq;
+          char ext[8];
+          if (std::sscanf(e->d_name, "pack-%16llx.%7s", &seq, ext) != 2) continue;
+          if (std::strcmp(ext, "pack") == 0) packs.push_back(seq);
+          else if (std::strcmp(ext, "idx") == 0) indexed.insert(seq);
+        }
+      ::closedir(d);
+      std::sort(packs.begin(), packs.end());
+
+      for (uint64_t seq : packs)
+        {
+          next_seq_ = std::max(next_seq_, seq + 1);
+          if (indexed.count(seq))
+            {
+              sealed_.push_back(load_sealed(seq));
+              continue;
+            }
+
+          // Unsealed: the newest one stays active, any older one was left
+          // by a crash during sealing or compaction and is sealed now.
+          int fd = open_pack(seq, false);
+          std::unordered_map<key_bytes, location, key_hash> index;
+          uint64_t end;
+          try
+            {
+              end = scan_pack(fd, index);
+              if (end < pack_header_size)
+                {
+                  uint8_t header[pack_header_size] = {};
+                  std::memcpy(header, pack_magic, sizeof(pack_magic));
+                  detail::store_littleendian32(header + 8, key_size);
+                  detail::write_fully(fd, header, sizeof(header), 0);
+                  end = pack_header_size;
+                }
+              if (::ftruncate(fd, end) != 0) throw std::system_error(errno, std::system_category(), pack_path(seq, "pack"));
+            }
+          catch (...)
+            {
+              ::close(fd);
+              throw;
+            }
+
+          if (active_fd_ >= 0) seal_pack_locked();
+          active_fd_ = fd;
+          active_seq_ = seq;
+          active_end_ = end;
+          active_index_ = std::move(index);
+        }
+
+      if (active_fd_ < 0) new_active_locked();
+    }
+
+  public:
+
+    // Opens or creates a store in directory `dir`. Packs are sealed once
+    // they grow past `pack_limit` bytes.
+    explicit blob_store(std::string dir, uint64_t pack_limit = 64 << 20)
+      : dir_(std::move(dir)), pack_limit_(pack_limit), lock_fd_(-1), active_fd_(-1), active_seq_(0), active_end_(0), next_seq_(1)
+    {
+      if (::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) throw std::system_error(errno, std::system_category(), dir_);
+
+      std::string lock = dir_ + "/lock";
+      lock_fd_ = ::open(lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if (lock_fd_ < 0) throw std::system_error(errno, std::system_category(), lock);
+      try
+        {
+          while (::flock(lock_fd_, LOCK_EX) != 0)
+            {
+              if (errno != EINTR) throw std::system_error(errno, std::system_category(), lock);
+            }
+          load();
+        }
+      catch (...)
+        {
+          if (active_fd_ >= 0) ::close(active_fd_);
+          ::close(lock_fd_);
+          throw;
+        }
+    }
+
+    blob_store(blob_store const &) = delete;
+    blob_store & operator=(blob_store const &) = delete;
+
+    ~blob_store()
+    {
+      {
+        std::lock_guard<std::mutex> guard(background_lock_);
+        if (background_.valid()) background_.wait();
+      }
+      if (active_fd_ >= 0) ::close(active_fd_);
+      ::close(lock_fd_);
+    }
+
+    bool contains(key_type const & key) const
+    {
+      std::shared_lock<std::shared_mutex> guard(lock_);
+      int fd;
+      location loc;
+      return find_locked(to_bytes(key), fd, loc);
+    }
+
+    // Reads a blob into `out`. Returns false if it is not stored.
+    bool get(key_type const & key, std::vector<uint8_t> & out) const
+    {
+      std::shared_lock<std::shared_mutex> guard(lock_);
+      int fd;
+      location loc;
+      if (!find_locked(to_bytes(key), fd, loc)) return false;
+      out.resize(loc.length);
+      detail::read_fully(fd, out.data(), loc.length, loc.offset);
+      return true;
+    }
+
+    // Stores a blob and returns its key. Storing a blob that is already
+    // present only hashes it.
+    key_type put(uint8_t const * data, size_t length)
+    {
+      Hasher h;
+      h.update(data, length);
+      key_type key = h.finalize();
+      key_bytes k = to_bytes(key);
+
+      std::unique_lock<std::shared_mutex> guard(lock_);
+      int fd;
+      location loc;
+      if (find_locked(k, fd, loc)) return key;
+
+      pending_record record = { k, data, length };
+      append_locked(&record, 1);
+      return key;
+    }
+
+    // Streams a blob from `fd` until end of file, hashing each block as it
+    // is written to a private staging file. The store is not locked while
+    // reading, so a slow source such as a socket holds up nobody else. The
+    // lock is taken only to check for an existing copy and to move the
+    // finished record into the active pack, a copy inside the kernel.
+    key_type put(int fd)
+    {
+      staging_file stage(dir_);
+      hashing_writer<Hasher, pack_sink> writer(pack_sink{ stage.fd, 8 });
+      std::vector<uint8_t> buf(copy_hash_block * 8);
+      for (;;)
+        {
+          ssize_t r = ::read(fd, buf.data(), buf.size());
+          if (r < 0)
+            {
+              if (errno == EINTR) continue;
+              throw std::system_error(errno, std::system_category(), "read");
+            }
+          if (r == 0) break;
+          writer.write(buf.data(), r);
+        }
+
+      uint64_t length = writer.sink().offset - 8;
+      key_type key = writer.finalize();
+      key_bytes k = to_bytes(key);
+      if (contains(key)) return key;
+
+      uint8_t len_bytes[8];
+      detail::store_littleendian64(len_bytes, length);
+      detail::write_fully(stage.fd, len_bytes, 8, 0);
+      detail::write_fully(stage.fd, k.data(), key_size, 8 + length);
+
+      std::unique_lock<std::shared_mutex> guard(lock_);
+      int existing_fd;
+      location loc;
+      if (find_locked(k, existing_fd, loc)) return key;
+
+      uint64_t start = active_end_;
+      detail::copy_fully(stage.fd, 0, active_fd_, start, 8 + length + key_size);
+      active_index_.emplace(k, location{ start + 8, length });
+      active_end_ = start + 8 + length + key_size;
+      if (active_end_ >= pack_limit_) seal_active_locked();
+      return key;
+    }
+
+    // Stores many blobs at once. Keys are computed in parallel on up to
+    // `threads` threads (0 means one per hardware thread), then all new
+    // blobs are gathered into the pack with pwritev under one lock
+    // acquisition.
+    std::vector<key_type> put_batch(std::vector<blob> const & blobs, unsigned threads = 0)
+    {
+      std::vector<key_type> keys(blobs.size());
+      parallel_for(0, blobs.size(), threads, [&](size_t i)
+        {
+          Hasher h;
+          h.update(blobs[i].data, blobs[i].length);
+          keys[i] = h.finalize();
+        });
+
+      std::unique_lock<std::shared_mutex> guard(lock_);
+      std::vector<pending_record> records;
+      std::unordered_set<key_bytes, key_hash> batch;
+      for (size_t i = 0; i < blobs.size(); i++)
+        {
+          key_bytes k = to_bytes(keys[i]);
+          int fd;
+          location loc;
+          if (find_locked(k, fd, loc) || !batch.insert(k).second) continue;
+          records.push_back({ k, blobs[i].data, blobs[i].length });
+        }
+      append_locked(records.data(), records.size());
+      return keys;
+    }
+
+    // Makes every blob stored so far durable.
+    void sync()
+    {
+      std::shared_lock<std::shared_mutex> guard(lock_);
+      sync_fd(active_fd_, pack_path(active_seq_, "pack"));
+    }
+
+    // Merges all sealed packs into one, dropping duplicates and any blob for
+    // which keep(key) returns false. Reads and writes carry on meanwhile;
+    // the store is only locked to swap the pack list at the end.
+    template <typename Keep>
+    void compact(Keep && keep)
+    {
+      std::lock_guard<std::mutex> compacting(compact_lock_);
+
+      std::vector<std::shared_ptr<sealed_pack>> old;
+      uint64_t seq;
+      {
+        std::unique_lock<std::shared_mutex> guard(lock_);
+        old = sealed_;
+        seq = next_seq_++;
+      }
+      if (old.empty()) return;
+
+      int fd = open_pack(seq, true);
+      std::vector<std::pair<key_bytes, location>> entries;
+      try
+        {
+          std::unordered_set<key_bytes, key_hash> seen;
+          uint64_t end = pack_header_size;
+          for (auto p = old.rbegin(); p != old.rend(); p++)
+            {
+              for (uint64_t i = 0; i < (*p)->count(); i++)
+                {
+                  key_bytes k;
+                  std::memcpy(k.data(), (*p)->entry(i), key_size);
+                  if (seen.count(k) || !keep(from_bytes(k.data()))) continue;
+                  seen.insert(k);
+
+                  uint64_t offset = detail::load_littleendian64((*p)->entry(i) + key_size);
+                  uint64_t length = detail::load_littleendian64((*p)->entry(i) + key_size + 8);
+                  uint8_t prefix[8];
+                  detail::store_littleendian64(prefix, length);
+                  detail::write_fully(fd, prefix, 8, end);
+                  detail::copy_fully((*p)->fd, offset, fd, end + 8, length);
+                  detail::write_fully(fd, k.data(), key_size, end + 8 + length);
+
+                  entries.push_back({ k, location{ end + 8, length } });
+                  end += 8 + length + key_size;
+                }
+            }
+          sync_fd(fd, pack_path(seq, "pack"));
+          ::close(fd);
+          fd = -1;
+          write_index(seq, entries);
+        }
+      catch (...)
+        {
+          if (fd >= 0) ::close(fd);
+          ::unlink(pack_path(seq, "pack").c_str());
+          throw;
+        }
+
+      std::shared_ptr<sealed_pack> merged = load_sealed(seq);
+      {
+        std::unique_lock<std::shared_mutex> guard(lock_);
+        std::vector<std::shared_ptr<sealed_pack>> kept;
+        for (auto & p : sealed_)
+          {
+            if (std::find(old.begin(), old.end(), p) == old.end()) kept.push_back(p);
+          }
+        // Anything sealed while compacting is newer than the merged pack.
+        kept.insert(kept.begin(), merged);
+        sealed_ = std::move(kept);
+      }
+
+      // Index first, so a crash here never leaves an index without its pack.
+      for (auto & p : old)
+        {
+          ::unlink(pack_path(p->seq, "idx").c_str());
+          ::unlink(pack_path(p->seq, "pack").c_str());
+        }
+      sync_dir();
+    }
+
+    void compact()
+    {
+      compact([](key_type const &) { return true; });
+    }
+
+    // Runs compact() on a background thread owned by the store. Does nothing
+    // if one is still running. The destructor waits for it; compact_wait()
+    // waits and rethrows its error. An error nobody waited for is rethrown
+    // by the next compact_async() instead.
+    void compact_async()
+    {
+      std::lock_guard<std::mutex> guard(background_lock_);
+      if (background_.valid())
+        {
+          if (background_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+          background_.get();
+        }
+      background_ = std::async(std::launch::async, [this]() { compact(); });
+    }
+
+    void compact_wait()
+    {
+      std::lock_guard<std::mutex> guard(background_lock_);
+      if (background_.valid()) background_.get();
+    }
+  };
+}
+
+#endif
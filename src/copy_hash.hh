@@ -0,0 +1,183 @@
+/*
+
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef IEV_HASH_COPY_HASH_HH
+#define IEV_HASH_COPY_HASH_HH
+
+#include "detail.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <inttypes.h>
+#include <system_error>
+#include <utility>
+
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace iev
+{
+  // Hashing fused with copying.
+  //
+  // Copying a buffer and then hashing it reads the source twice; once the
+  // buffer is larger than the cache both passes come from DRAM. These helpers
+  // walk the source in small blocks, hash each block and then copy or write
+  // it while it is still in L1, so the source is only read from memory once.
+  // Hasher is any incremental hasher in this library.
+
+  // Block size used when interleaving hashing with copying. Small enough that
+  // a block stays in L1 between the two uses. Smaller blocks measure about
+  // the same for copies (bench/copy_hash.cc), but hashing_writer makes one
+  // sink call, often a syscall, per block.
+  constexpr size_t copy_hash_block = 8 * 1024;
+
+  // Copies at or above this size use non-temporal stores so the destination
+  // does not evict the source (or anything else) from the cache. Below it
+  // the destination is likely to be read again soon and plain stores
+  // measure faster; the crossover in bench/copy_hash.cc sits between 16 and
+  // 32 MiB, around the size of a last level cache.
+  constexpr size_t copy_hash_stream_threshold = 32 << 20;
+
+  namespace detail
+  {
+    inline void stream_copy(uint8_t * dst, uint8_t const * src, size_t len) noexcept
+    {
+#ifdef __SSE2__
+      size_t head = (16 - (reinterpret_cast<uintptr_t>(dst) & 15)) & 15;
+      head = std::min(head, len);
+      std::memcpy(dst, src, head);
+      dst += head;
+      src += head;
+      len -= head;
+
+      for (; len >= 64; len -= 64, dst += 64, src += 64)
+        {
+          __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src));
+          __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + 16));
+          __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + 32));
+          __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + 48));
+          _mm_stream_si128(reinterpret_cast<__m128i *>(dst), a);
+          _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 16), b);
+          _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 32), c);
+          _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 48), d);
+        }
+#endif
+      std::memcpy(dst, src, len);
+    }
+
+    inline void stream_fence() noexcept
+    {
+#ifdef __SSE2__
+      _mm_sfence();
+#endif
+    }
+
+    // copy_and_hash with the block size and store kind given explicitly, so
+    // bench/copy_hash.cc can sweep them.
+    template <typename Hasher>
+    void copy_and_hash_blocks(uint8_t * out, uint8_t const * in, size_t len, Hasher & hasher, size_t block, bool stream)
+    {
+      while (len != 0)
+        {
+          size_t n = std::min(len, block);
+          hasher.update(in, n);
+          if (stream) stream_copy(out, in, n);
+          else std::memcpy(out, in, n);
+          in += n;
+          out += n;
+          len -= n;
+        }
+
+      if (stream) stream_fence();
+    }
+  }
+
+  // Copies len bytes from src to dst and feeds them to hasher in one pass.
+  // The buffers must not overlap.
+  template <typename Hasher>
+  void copy_and_hash(void * dst, void const * src, size_t len, Hasher & hasher)
+  {
+    detail::copy_and_hash_blocks(static_cast<uint8_t *>(dst), static_cast<uint8_t const *>(src), len, hasher, copy_hash_block, len >= copy_hash_stream_threshold);
+  }
+
+
+  // Writes to an fd, retrying short writes.
+  class fd_sink
+  {
+    int fd_;
+
+  public:
+    explicit fd_sink(int fd) noexcept
+      : fd_(fd)
+    {
+    }
+
+    void operator()(uint8_t const * data, size_t len)
+    {
+      while (len != 0)
+        {
+          ssize_t r = ::write(fd_, data, len);
+          if (r < 0)
+            {
+              if (errno == EINTR) continue;
+              throw std::system_error(errno, std::system_category(), "write");
+            }
+          data += r;
+          len -= r;
+        }
+    }
+  };
+
+  // Passes everything written through to Sink, a callable taking
+  // (uint8_t const *, size_t), hashing each block just before it is handed
+  // on so the sink's copy (into a socket or page cache) reads it from L1.
+  template <typename Hasher, typename Sink = fd_sink>
+  class hashing_writer
+  {
+    Hasher hasher_;
+    Sink sink_;
+
+  public:
+    using digest_type = detail::digest_of<Hasher>;
+
+    explicit hashing_writer(Sink sink, Hasher hasher = Hasher())
+      : hasher_(std::move(hasher)), sink_(std::move(sink))
+    {
+    }
+
+    void write(uint8_t const * data, size_t len)
+    {
+      while (len != 0)
+        {
+          size_t n = std::min(len, copy_hash_block);
+          hasher_.update(data, n);
+          sink_(data, n);
+          data += n;
+          len -= n;
+        }
+    }
+
+    digest_type finalize()
+    {
+      return hasher_.finalize();
+    }
+
+    Sink & sink() noexcept
+    {
+      return sink_;
+    }
+  };
+}
+
+#endif
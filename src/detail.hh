@@ -0,0 +1,193 @@
+/* 
+ 
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef IEV_HASH_DETAIL_HH
+#define IEV_HASH_DETAIL_HH
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <inttypes.h>
+#include <system_error>
+#include <utility>
+
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace iev
+{
+  namespace sha256 { class sum; }
+  class sha512;
+  template <size_t N> class blake2b;
+
+  namespace detail
+  {
+    // Identifies a digest algorithm inside the files this library writes
+    // (chunk manifests, digest caches). Zero is never used, so it can mark
+    // an empty slot.
+    template <typename Digest>
+    struct digest_algorithm;
+
+    template <>
+    struct digest_algorithm<sha256::sum>
+    {
+      static constexpr uint32_t value = 1;
+    };
+
+    template <>
+    struct digest_algorithm<sha512>
+    {
+      static constexpr uint32_t value = 2;
+    };
+
+    template <size_t N>
+    struct digest_algorithm<blake2b<N>>
+    {
+      static constexpr uint32_t value = 0x100 + N;
+    };
+
+    // The digest type Hasher produces. All of the digest types are plain
+    // byte arrays, so sizeof gives the digest length.
+    template <typename Hasher>
+    using digest_of = decltype(std::declval<Hasher &>().finalize());
+
+    inline uint32_t load_littleendian32(uint8_t const * x) noexcept
+    {
+      return uint32_t(x[0]) | uint32_t(x[1]) << 8 | uint32_t(x[2]) << 16 | uint32_t(x[3]) << 24;
+    }
+
+    inline void store_littleendian32(uint8_t * x, uint32_t u) noexcept
+    {
+      for (int i = 0; i < 4; i++, u >>= 8) x[i] = u;
+    }
+
+    inline uint64_t load_littleendian64(uint8_t const * x) noexcept
+    {
+      uint64_t u = 0;
+      for (int i = 7; i >= 0; i--) u = (u << 8) | x[i];
+      return u;
+    }
+
+    inline void store_littleendian64(uint8_t * x, uint64_t u) noexcept
+    {
+      for (int i = 0; i < 8; i++, u >>= 8) x[i] = u;
+    }
+
+    // Reads up to `len` bytes at `offset`, stopping early only at end of
+    // file. Returns the number of bytes read.
+    inline size_t read_at(int fd, uint8_t * buf, size_t len, uint64_t offset)
+    {
+      size_t done = 0;
+      while (done != len)
+        {
+          ssize_t r = ::pread(fd, buf + done, len - done, offset + done);
+          if (r < 0)
+            {
+              if (errno == EINTR) continue;
+              throw std::system_error(errno, std::system_category(), "pread");
+            }
+          if (r == 0) break;
+          done += r;
+        }
+      return done;
+    }
+
+    // As read_at, but running into end of file is an error.
+    inline void read_fully(int fd, uint8_t * buf, size_t len, uint64_t offset)
+    {
+      if (read_at(fd, buf, len, offset) != len) throw std::system_error(EIO, std::system_category(), "pread: unexpected end of file");
+    }
+
+    inline void write_fully(int fd, uint8_t const * buf, size_t len, uint64_t offset)
+    {
+      while (len != 0)
+        {
+          ssize_t r = ::pwrite(fd, buf, len, offset);
+          if (r < 0)
+            {
+              if (errno == EINTR) continue;
+              throw std::system_error(errno, std::system_category(), "pwrite");
+            }
+          buf += r;
+          len -= r;
+          offset += r;
+        }
+    }
+
+    // Copies `len` bytes between two files, inside the kernel where it can
+    // (copy_file_range, which may also share extents), otherwise through a
+    // buffer.
+    inline void copy_fully(int in, uint64_t in_offset, int out, uint64_t out_offset, uint64_t len)
+    {
+      while (len != 0)
+        {
+          loff_t from = in_offset;
+          loff_t to = out_offset;
+          ssize_t r = ::copy_file_range(in, &from, out, &to, len, 0);
+          if (r < 0)
+            {
+              if (errno == EINTR) continue;
+              if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+                {
+                  throw std::system_error(errno, std::system_category(), "copy_file_range");
+                }
+              break;
+            }
+          if (r == 0) throw std::system_error(EIO, std::system_category(), "copy_file_range: unexpected end of file");
+          in_offset += r;
+          out_offset += r;
+          len -= r;
+        }
+
+      uint8_t buf[64 * 1024];
+      while (len != 0)
+        {
+          size_t n = std::min<uint64_t>(len, sizeof(buf));
+          read_fully(in, buf, n, in_offset);
+          write_fully(out, buf, n, out_offset);
+          in_offset += n;
+          out_offset += n;
+          len -= n;
+        }
+    }
+
+    // Gathers iov[0, count) to `offset`, retrying short writes. Consumes
+    // the iovec array as it goes.
+    inline void writev_fully(int fd, struct iovec * iov, size_t count, uint64_t offset)
+    {
+      while (count != 0)
+        {
+          ssize_t r = ::pwritev(fd, iov, int(std::min<size_t>(count, IOV_MAX)), offset);
+          if (r < 0)
+            {
+              if (errno == EINTR) continue;
+              throw std::system_error(errno, std::system_category(), "pwritev");
+            }
+          offset += r;
+
+          size_t done = r;
+          while (count != 0 && done >= iov->iov_len)
+            {
+              done -= iov->iov_len;
+              iov++;
+              count--;
+            }
+          if (count != 0)
+            {
+              iov->iov_base = static_cast<uint8_t *>(iov->iov_base) + done;
+              iov->iov_len -= done;
+            }
+        }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,513 @@
+/*
+
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef IEV_HASH_DIGEST_CACHE_HH
+#define IEV_HASH_DIGEST_CACHE_HH
+
+#include "detail.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <inttypes.h>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace iev
+{
+  // The fields of a stat() result that decide whether a file may have
+  // changed since it was hashed.
+  struct file_identity
+  {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+
+    static file_identity of(struct stat const & st) noexcept
+    {
+      file_identity id;
+      id.device = st.st_dev;
+      id.inode = st.st_ino;
+      id.size = st.st_size;
+      id.mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+      id.ctime_ns = int64_t(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+      return id;
+    }
+
+    bool operator ==(file_identity const & other) const noexcept
+    {
+      return device == other.device && inode == other.inode && size == other.size
+        && mtime_ns == other.mtime_ns && ctime_ns == other.ctime_ns;
+    }
+
+    bool operator !=(file_identity const & other) const noexcept
+    {
+      return !(*this == other);
+    }
+  };
+
+
+  // Persistent cache of file digests keyed by (device, inode, algorithm) and
+  // validated against size, mtime and ctime, so unchanged files are not
+  // rehashed.
+  //
+  // The file is an open addressed, linearly probed table of fixed size slots
+  // used in place through mmap; opening it does not parse anything. Any
+  // number of processes may read while one writer (serialized with flock)
+  // updates it:
+  //
+  //  - each slot has a sequence number which is odd while it is being
+  //    written, so readers retry or skip a slot that changes under them;
+  //  - each slot carries a checksum of its contents, so a slot torn by a
+  //    crash or power loss reads as empty rather than as a wrong digest;
+  //  - growing the table writes a new file and renames it over the old one,
+  //    so a crash leaves either the old or the new table.
+  //
+  // The file is in native byte order and is not meant to be shared between
+  // architectures; a foreign file fails the header check and is replaced.
+  class digest_cache
+  {
+    struct header
+    {
+      char magic[8];
+      uint32_t version;
+      uint32_t slot_size;
+      uint64_t capacity;
+      uint64_t used;
+      uint8_t reserved[32];
+    };
+
+    struct slot
+    {
+      uint64_t seq;
+      uint64_t device;
+      uint64_t inode;
+      uint64_t size;
+      int64_t mtime_ns;
+      int64_t ctime_ns;
+      uint32_t algorithm;
+      uint32_t digest_len;
+      uint8_t digest[64];
+      uint64_t check;
+    };
+
+    static_assert(sizeof(header) == 64, "header layout");
+    static_assert(sizeof(slot) == 128, "slot layout");
+
+    static constexpr char magic[8] = { 'I', 'E', 'V', 'D', 'C', 'C', 'H', '1' };
+    static constexpr uint32_t version = 1;
+
+    std::string path_;
+    bool writable_;
+    int lock_fd_;
+    int fd_;
+    void * map_;
+    size_t map_length_;
+    uint64_t inode_;
+
+    header * head() const noexcept { return static_cast<header *>(map_); }
+    slot * slots() const noexcept { return reinterpret_cast<slot *>(static_cast<uint8_t *>(map_) + sizeof(header)); }
+    uint64_t capacity() const noexcept { return head()->capacity; }
+
+    static uint64_t checksum(slot const & s) noexcept
+    {
+      // FNV-1a over everything but seq and check. Only has to catch torn
+      // writes, not tampering.
+      uint8_t const * p = reinterpret_cast<uint8_t const *>(&s) + sizeof(s.seq);
+      size_t n = sizeof(slot) - sizeof(s.seq) - sizeof(s.check);
+      uint64_t h = 0xcbf29ce484222325ULL;
+      for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 0x100000001b3ULL;
+      return h;
+    }
+
+    static uint64_t home(uint64_t device, uint64_t inode, uint32_t algorithm) noexcept
+    {
+      uint64_t h = inode * 0x9e3779b97f4a7c15ULL ^ device * 0xc2b2ae3d27d4eb4fULL ^ algorithm;
+      h ^= h >> 29;
+      h *= 0xbf58476d1ce4e5b9ULL;
+      return h ^ (h >> 32);
+    }
+
+    // Copies a consistent snapshot of s into out. Returns false for a slot
+    // that is mid-write or torn.
+    static bool read_slot(slot const & s, slot & out) noexcept
+    {
+      for (int attempt = 0; attempt < 64; attempt++)
+        {
+          uint64_t before = __atomic_load_n(&s.seq, __ATOMIC_ACQUIRE);
+          if (before & 1) continue;
+          std::memcpy(&out, &s, sizeof(slot));
+          __atomic_thread_fence(__ATOMIC_ACQUIRE);
+          if (__atomic_load_n(&s.seq, __ATOMIC_RELAXED) != before) continue;
+          return out.algorithm == 0 || out.check == checksum(out);
+        }
+      return false;
+    }
+
+    static void write_slot(slot & s, slot const & value) noexcept
+    {
+      uint64_t seq = __atomic_load_n(&s.seq, __ATOMIC_RELAXED) | 1;
+      __atomic_store_n(&s.seq, seq, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      std::memcpy(reinterpret_cast<uint8_t *>(&s) + sizeof(s.seq), reinterpret_cast<uint8_t const *>(&value) + sizeof(s.seq), sizeof(slot) - sizeof(s.seq));
+      __atomic_store_n(&s.seq, seq + 1, __ATOMIC_RELEASE);
+    }
+
+    static bool valid_header(void const * map, size_t length) noexcept
+    {
+      if (length < sizeof(header)) return false;
+      header const * h = static_cast<header const *>(map);
+      return std::memcmp(h->magic, magic, sizeof(magic)) == 0
+        && h->version == version
+        && h->slot_size == sizeof(slot)
+        && h->capacity != 0
+        && (h->capacity & (h->capacity - 1)) == 0
+        && length == sizeof(header) + h->capacity * sizeof(slot);
+    }
+
+    void unmap() noexcept
+    {
+      if (map_ != MAP_FAILED) ::munmap(map_, map_length_);
+      if (fd_ >= 0) ::close(fd_);
+      map_ = MAP_FAILED;
+      fd_ = -1;
+    }
+
+    // Writes an empty table of `capacity` slots holding `entries` to a
+    // temporary file and renames it into place.
+    void create(uint64_t capacity, std::vector<slot> const & entries)
+    {
+      std::string tmp = path_ + ".tmp";
+      int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd < 0) throw std::system_error(errno, std::system_category(), tmp);
+
+      size_t length = sizeof(header) + capacity * sizeof(slot);
+      void * map = MAP_FAILED;
+      if (::ftruncate(fd, length) == 0) map = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (map == MAP_FAILED)
+        {
+          int e = errno;
+          ::close(fd);
+          ::unlink(tmp.c_str());
+          throw std::system_error(e, std::system_category(), tmp);
+        }
+
+      header * h = static_cast<header *>(map);
+      std::memcpy(h->magic, magic, sizeof(magic));
+      h->version = version;
+      h->slot_size = sizeof(slot);
+      h->capacity = capacity;
+      h->used = entries.size();
+
+      slot * table = reinterpret_cast<slot *>(static_cast<uint8_t *>(map) + sizeof(header));
+      for (slot const & s : entries)
+        {
+          uint64_t i = home(s.device, s.inode, s.algorithm) & (capacity - 1);
+          while (table[i].algorithm != 0) i = (i + 1) & (capacity - 1);
+          table[i] = s;
+          table[i].seq = 0;
+        }
+
+      bool ok = ::msync(map, length, MS_SYNC) == 0 && ::fsync(fd) == 0;
+      int e = errno;
+      ::munmap(map, length);
+      ::close(fd);
+      if (!ok || ::rename(tmp.c_str(), path_.c_str()) != 0)
+        {
+          if (ok) e = errno;
+          ::unlink(tmp.c_str());
+          throw std::system_error(e, std::system_category(), path_);
+        }
+    }
+
+    // Maps path_; returns false if it is missing or not a valid cache.
+    bool map_existing()
+    {
+      int fd = ::open(path_.c_str(), (writable_ ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+      if (fd < 0)
+        {
+          if (errno == ENOENT) return false;
+          throw std::system_error(errno, std::system_category(), path_);
+        }
+
+      struct stat st;
+      void * map = MAP_FAILED;
+      if (::fstat(fd, &st) == 0 && st.st_size != 0)
+        {
+          map = ::mmap(nullptr, st.st_size, writable_ ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        }
+      if (map == MAP_FAILED || !valid_header(map, st.st_size))
+        {
+          if (map != MAP_FAILED) ::munmap(map, st.st_size);
+          ::close(fd);
+          return false;
+        }
+
+      unmap();
+      fd_ = fd;
+      map_ = map;
+      map_length_ = st.st_size;
+      inode_ = st.st_ino;
+      return true;
+    }
+
+    void open_writer(uint64_t capacity)
+    {
+      // The lock lives on a separate file because the table itself is
+      // replaced by rename when it grows.
+      std::string lock = path_ + ".lock";
+      lock_fd_ = ::open(lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if (lock_fd_ < 0) throw std::system_error(errno, std::system_category(), lock);
+      while (::flock(lock_fd_, LOCK_EX) != 0)
+        {
+          if (errno != EINTR) throw std::system_error(errno, std::system_category(), lock);
+        }
+
+      if (!map_existing())
+        {
+          uint64_t c = 1;
+          while (c < capacity) c <<= 1;
+          create(c, {});
+          if (!map_existing()) throw std::system_error(EIO, std::system_category(), path_);
+        }
+    }
+
+    void grow()
+    {
+      std::vector<slot> entries;
+      for (uint64_t i = 0; i < capacity(); i++)
+        {
+          slot s;
+          if (read_slot(slots()[i], s) && s.algorithm != 0) entries.push_back(s);
+        }
+      create(capacity() * 2, entries);
+      if (!map_existing()) throw std::system_error(EIO, std::system_category(), path_);
+    }
+
+    template <typename Digest>
+    static constexpr size_t digest_size() noexcept
+    {
+      return sizeof(Digest);
+    }
+
+  public:
+
+    // Opens (creating if needed when writable) the cache at `path`. A
+    // writable cache takes an exclusive lock on `path`.lock for its
+    // lifetime; read only opens never block. A reader finding no valid
+    // cache behaves as an empty one.
+    explicit digest_cache(std::string path, bool writable = false, uint64_t capacity = 1 << 16)
+      : path_(std::move(path)), writable_(writable), lock_fd_(-1), fd_(-1), map_(MAP_FAILED), map_length_(0), inode_(0)
+    {
+      if (writable_)
+        {
+          try
+            {
+              open_writer(capacity);
+            }
+          catch (...)
+            {
+              if (lock_fd_ >= 0) ::close(lock_fd_);
+              throw;
+            }
+        }
+      else
+        {
+          map_existing();
+        }
+    }
+
+    digest_cache(digest_cache const &) = delete;
+    digest_cache & operator=(digest_cache const &) = delete;
+
+    ~digest_cache()
+    {
+      unmap();
+      if (lock_fd_ >= 0) ::close(lock_fd_);
+    }
+
+    // Picks up a table the writer has replaced since this one was opened.
+    void refresh()
+    {
+      struct stat st;
+      if (::stat(path_.c_str(), &st) == 0 && (map_ == MAP_FAILED || st.st_ino != inode_)) map_existing();
+    }
+
+    // Finds the digest recorded for a file. Returns false if there is none
+    // or if any identity field differs from when it was recorded.
+    template <typename Digest>
+    bool lookup(file_identity const & id, Digest & out) const noexcept
+    {
+      static_assert(digest_size<Digest>() <= sizeof(slot::digest), "digest too large");
+      constexpr uint32_t algorithm = detail::digest_algorithm<Digest>::value;
+      if (map_ == MAP_FAILED) return false;
+
+      uint64_t mask = capacity() - 1;
+      uint64_t i = home(id.device, id.inode, algorithm) & mask;
+      for (uint64_t n = 0; n <= mask; n++, i = (i + 1) & mask)
+        {
+          slot s;
+          if (!read_slot(slots()[i], s)) continue;
+          if (s.algorithm == 0) return false;
+          if (s.algorithm != algorithm || s.device != id.device || s.inode != id.inode) continue;
+
+          if (s.size != id.size || s.mtime_ns != id.mtime_ns || s.ctime_ns != id.ctime_ns
+              || s.digest_len != digest_size<Digest>())
+            {
+              return false;
+            }
+          std::copy(s.digest, s.digest + digest_size<Digest>(), out.begin());
+          return true;
+        }
+      return false;
+    }
+
+    // Records a digest, replacing any older entry for the same file and
+    // algorithm. Only valid on a writable cache.
+    template <typename Digest>
+    void store(file_identity const & id, Digest const & digest)
+    {
+      static_assert(digest_size<Digest>() <= sizeof(slot::digest), "digest too large");
+      constexpr uint32_t algorithm = detail::digest_algorithm<Digest>::value;
+      if (!writable_) throw std::system_error(EBADF, std::system_category(), path_);
+
+      // Keep the load factor at or under 3/4 so probe runs stay short.
+      if ((head()->used + 1) * 4 > capacity() * 3) grow();
+
+      slot value;
+      std::memset(&value, 0, sizeof(value));
+      value.device = id.device;
+      value.inode = id.inode;
+      value.size = id.size;
+      value.mtime_ns = id.mtime_ns;
+      value.ctime_ns = id.ctime_ns;
+      value.algorithm = algorithm;
+      value.digest_len = digest_size<Digest>();
+      std::copy(digest.begin(), digest.end(), value.digest);
+      value.check = checksum(value);
+
+      uint64_t mask = capacity() - 1;
+      uint64_t i = home(id.device, id.inode, algorithm) & mask;
+      slot * reusable = nullptr;
+      for (uint64_t n = 0; n <= mask; n++, i = (i + 1) & mask)
+        {
+          slot s;
+          if (!read_slot(slots()[i], s))
+            {
+              // Torn by a crash; reclaim it unless the key turns up later.
+              if (!reusable) reusable = &slots()[i];
+              continue;
+            }
+          if (s.algorithm == 0)
+            {
+              if (!reusable)
+                {
+                  reusable = &slots()[i];
+                  head()->used++;
+                }
+              break;
+            }
+          if (s.algorithm == algorithm && s.device == id.device && s.inode == id.inode)
+            {
+              reusable = &slots()[i];
+              break;
+            }
+        }
+
+      if (reusable) write_slot(*reusable, value);
+    }
+
+    // Flushes the table to disk.
+    void sync()
+    {
+      if (map_ != MAP_FAILED && ::msync(map_, map_length_, MS_SYNC) != 0)
+        {
+          throw std::system_error(errno, std::system_category(), path_);
+        }
+    }
+
+    // Returns the digest of the file at `path`, from the cache if its
+    // identity is unchanged and otherwise by hashing it with Hasher (and
+    // recording the result when writable). A hit costs one stat().
+    template <typename Hasher>
+    auto hash_file(char const * path)
+    {
+      using digest_type = detail::digest_of<Hasher>;
+
+      struct stat st;
+      if (::stat(path, &st) != 0) throw std::system_error(errno, std::system_category(), path);
+
+      digest_type out;
+      if (lookup(file_identity::of(st), out)) return out;
+
+      int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0) throw std::system_error(errno, std::system_category(), path);
+
+      Hasher h;
+      file_identity before = {};
+      file_identity after = {};
+      try
+        {
+          if (::fstat(fd, &st) != 0) throw std::system_error(errno, std::system_category(), path);
+          before = file_identity::of(st);
+
+          uint8_t buf[64 * 1024];
+          for (;;)
+            {
+              ssize_t r = ::read(fd, buf, sizeof(buf));
+              if (r < 0)
+                {
+                  if (errno == EINTR) continue;
+                  throw std::system_error(errno, std::system_category(), path);
+                }
+              if (r == 0) break;
+              h.update(buf, r);
+            }
+
+          if (::fstat(fd, &st) != 0) throw std::system_error(errno, std::system_category(), path);
+          after = file_identity::of(st);
+        }
+      catch (...)
+        {
+          ::close(fd);
+          throw;
+        }
+      ::close(fd);
+
+      out = h.finalize();
+
+      // Don't record a file that changed while it was read, or one modified
+      // so recently that a further write could land in the same timestamp
+      // tick and leave the identity unchanged.
+      struct timespec now;
+      ::clock_gettime(CLOCK_REALTIME, &now);
+      int64_t now_ns = int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+      if (writable_ && before == after && now_ns - std::max(after.mtime_ns, after.ctime_ns) > 2000000000LL)
+        {
+          store(after, out);
+        }
+
+      return out;
+    }
+  };
+}
+
+#endif
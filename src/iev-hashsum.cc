@@ -0,0 +1,359 @@
+/*
+
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+// iev-hashsum: parallel sha256sum / sha512sum / b2sum.
+//
+// Directories given on the command line are walked recursively. Files are
+// hashed on a pool of threads, one file per thread at a time, and results
+// are printed in a stable order (arguments in order, directory contents
+// sorted by path) as soon as every earlier file is done. Output and -c
+// input use the coreutils format, so sums can be checked with
+// sha256sum -c, sha512sum -c or b2sum -c and vice versa.
+
+#include "blake2b.hh"
+#include "parallel.hh"
+#include "sha256.hh"
+#include "sha512.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+namespace
+{
+  struct options
+  {
+    unsigned threads = 0;
+    bool check = false;
+    bool quiet = false;
+    std::vector<std::string> paths;
+  };
+
+  struct result
+  {
+    std::string digest;
+    std::string error;
+  };
+
+  char const * program = "iev-hashsum";
+
+  template <typename Hasher>
+  std::string hash_fd(int fd)
+  {
+    thread_local std::vector<uint8_t> buf(256 * 1024);
+    Hasher h;
+
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (;;)
+      {
+        ssize_t r = ::read(fd, buf.data(), buf.size());
+        if (r < 0)
+          {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::system_category());
+          }
+        if (r == 0) break;
+        h.update(buf.data(), r);
+      }
+
+    static char const hex[] = "0123456789abcdef";
+    auto d = h.finalize();
+    std::string out;
+    for (auto it = d.begin(); it != d.end(); it++)
+      {
+        out += hex[*it >> 4];
+        out += hex[*it & 15];
+      }
+    return out;
+  }
+
+  template <typename Hasher>
+  result hash_path(std::string const & path)
+  {
+    result r;
+    int fd = path == "-" ? 0 : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      {
+        r.error = std::strerror(errno);
+        return r;
+      }
+
+    try
+      {
+        r.digest = hash_fd<Hasher>(fd);
+      }
+    catch (std::system_error const & e)
+      {
+        r.error = std::strerror(e.code().value());
+      }
+
+    if (fd != 0) ::close(fd);
+    return r;
+  }
+
+  // Names containing a newline or backslash are escaped the way coreutils
+  // does it: the line gets a leading backslash and both are escaped.
+  bool needs_escape(std::string const & name)
+  {
+    return name.find_first_of("\\\n") != std::string::npos;
+  }
+
+  std::string escape(std::string const & name)
+  {
+    std::string out;
+    for (char c : name)
+      {
+        if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else out += c;
+      }
+    return out;
+  }
+
+  std::string unescape(std::string const & name)
+  {
+    std::string out;
+    for (size_t i = 0; i < name.size(); i++)
+      {
+        if (name[i] == '\\' && i + 1 < name.size())
+          {
+            i++;
+            out += name[i] == 'n' ? '\n' : name[i];
+          }
+        else out += name[i];
+      }
+    return out;
+  }
+
+  // Expands directories into their regular files, sorted, keeping argument
+  // order otherwise.
+  std::vector<std::string> expand(std::vector<std::string> const & args, bool & ok)
+  {
+    namespace fs = std::filesystem;
+    std::vector<std::string> files;
+
+    for (auto const & arg : args)
+      {
+        std::error_code ec;
+        if (arg == "-" || !fs::is_directory(arg, ec))
+          {
+            files.push_back(arg);
+            continue;
+          }
+
+        std::vector<std::string> found;
+        for (fs::recursive_directory_iterator it(arg, ec), end; !ec && it != end; it.increment(ec))
+          {
+            std::error_code fec;
+            if (it->is_regular_file(fec)) found.push_back(it->path().string());
+          }
+        if (ec)
+          {
+            std::cerr << program << ": " << arg << ": " << ec.message() << "\n";
+            ok = false;
+          }
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+      }
+
+    return files;
+  }
+
+  // Hashes every file on the pool and hands results to emit(i, result) in
+  // index order, each one as soon as it and all earlier ones are done.
+  template <typename Hasher, typename Emit>
+  void hash_all(std::vector<std::string> const & files, unsigned threads, Emit && emit)
+  {
+    std::vector<result> results(files.size());
+    std::vector<char> done(files.size(), 0);
+    size_t next = 0;
+    std::mutex lock;
+
+    iev::parallel_for(0, files.size(), threads, [&](size_t i)
+      {
+        result r = hash_path<Hasher>(files[i]);
+
+        std::lock_guard<std::mutex> guard(lock);
+        results[i] = std::move(r);
+        done[i] = 1;
+        while (next < files.size() && done[next])
+          {
+            emit(next, results[next]);
+            results[next] = result();
+            next++;
+          }
+      });
+  }
+
+  template <typename Hasher>
+  int sum(options const & opt)
+  {
+    bool ok = true;
+    std::vector<std::string> files = expand(opt.paths, ok);
+
+    hash_all<Hasher>(files, opt.threads, [&](size_t i, result const & r)
+      {
+        if (!r.error.empty())
+          {
+            std::cerr << program << ": " << files[i] << ": " << r.error << "\n";
+            ok = false;
+            return;
+          }
+        if (needs_escape(files[i])) std::cout << '\\' << r.digest << "  " << escape(files[i]) << '\n';
+        else std::cout << r.digest << "  " << files[i] << '\n';
+      });
+
+    std::cout.flush();
+    return ok ? 0 : 1;
+  }
+
+  template <typename Hasher>
+  int check(options const & opt)
+  {
+    std::vector<std::string> files;
+    std::vector<std::string> expected;
+    size_t malformed = 0;
+
+    for (auto const & list : opt.paths)
+      {
+        std::ifstream file;
+        std::istream * in = &std::cin;
+        if (list != "-")
+          {
+            file.open(list);
+            if (!file)
+              {
+                std::cerr << program << ": " << list << ": " << std::strerror(errno) << "\n";
+                return 1;
+              }
+            in = &file;
+          }
+
+        std::string line;
+        while (std::getline(*in, line))
+          {
+            bool escaped = !line.empty() && line[0] == '\\';
+            size_t start = escaped ? 1 : 0;
+            size_t space = line.find(' ', start);
+            if (space == std::string::npos || space + 2 > line.size() || (line[space + 1] != ' ' && line[space + 1] != '*'))
+              {
+                malformed++;
+                continue;
+              }
+            std::string name = line.substr(space + 2);
+            expected.push_back(line.substr(start, space - start));
+            files.push_back(escaped ? unescape(name) : name);
+          }
+      }
+
+    size_t failed = 0;
+    size_t unreadable = 0;
+
+    // Status lines escape names the way sum mode does, so a newline in a
+    // name cannot forge an extra line.
+    auto status = [&](size_t i) -> std::ostream &
+      {
+        if (needs_escape(files[i])) return std::cout << '\\' << escape(files[i]) << ": ";
+        return std::cout << files[i] << ": ";
+      };
+
+    hash_all<Hasher>(files, opt.threads, [&](size_t i, result const & r)
+      {
+        if (!r.error.empty())
+          {
+            std::cerr << program << ": " << files[i] << ": " << r.error << "\n";
+            status(i) << "FAILED open or read\n";
+            unreadable++;
+          }
+        else if (r.digest != expected[i])
+          {
+            status(i) << "FAILED\n";
+            failed++;
+          }
+        else if (!opt.quiet)
+          {
+            status(i) << "OK\n";
+          }
+      });
+
+    std::cout.flush();
+    if (malformed) std::cerr << program << ": WARNING: " << malformed << " lines are improperly formatted\n";
+    if (unreadable) std::cerr << program << ": WARNING: " << unreadable << " listed files could not be read\n";
+    if (failed) std::cerr << program << ": WARNING: " << failed << " computed checksums did NOT match\n";
+    return failed || unreadable || files.empty() ? 1 : 0;
+  }
+
+  template <typename Hasher>
+  int run(options const & opt)
+  {
+    return opt.check ? check<Hasher>(opt) : sum<Hasher>(opt);
+  }
+
+  void usage(std::ostream & out)
+  {
+    out << "Usage: " << program << " [-a sha256|sha512|blake2b] [-j THREADS] [-c [-q]] [FILE|DIR]...\n"
+        << "Print or check checksums of files, recursing into directories.\n"
+        << "Output is compatible with sha256sum, sha512sum and b2sum.\n";
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  options opt;
+  std::string algorithm = "sha256";
+
+  int c;
+  while ((c = ::getopt(argc, argv, "a:j:cqh")) != -1)
+    {
+      switch (c)
+        {
+        case 'a': algorithm = optarg; break;
+        case 'j': opt.threads = std::strtoul(optarg, nullptr, 10); break;
+        case 'c': opt.check = true; break;
+        case 'q': opt.quiet = true; break;
+        case 'h': usage(std::cout); return 0;
+        default: usage(std::cerr); return 1;
+        }
+    }
+
+  for (int i = optind; i < argc; i++) opt.paths.push_back(argv[i]);
+  if (opt.paths.empty()) opt.paths.push_back("-");
+
+  std::ios::sync_with_stdio(false);
+
+  if (algorithm == "sha256") return run<iev::sha256::incremental_hasher>(opt);
+  if (algorithm == "sha512") return run<iev::sha512::incremental_hasher>(opt);
+  if (algorithm == "blake2b")
+    {
+      if (::sodium_init() < 0)
+        {
+          std::cerr << program << ": libsodium failed to initialize\n";
+          return 1;
+        }
+      return run<iev::blake2b<512>::incremental_hasher>(opt);
+    }
+
+  std::cerr << program << ": unknown algorithm " << algorithm << "\n";
+  return 1;
+}
@@ -0,0 +1,706 @@
+/*
+
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef IEV_HASH_KDF_HH
+#define IEV_HASH_KDF_HH
+
+#include "detail.hh"
+#include "parallel.hh"
+#include "sha256.hh"
+#include "sha512.hh"
+
+#include <algorithm>
+#include <array>
+#include <inttypes.h>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace iev
+{
+  // HMAC (RFC 2104) over any incremental hasher in this library.
+  //
+  // The hasher states after absorbing the padded key are kept, so every
+  // message after the first costs only the compressions of the message
+  // itself. finalize() resets for the next message under the same key.
+  template <typename Hasher>
+  class hmac
+  {
+  public:
+    using digest_type = detail::digest_of<Hasher>;
+    static constexpr size_t block_size = Hasher::block_size;
+    static constexpr size_t digest_size = sizeof(digest_type);
+
+  private:
+    Hasher inner_;
+    Hasher outer_;
+    Hasher running_;
+
+  public:
+    constexpr hmac(uint8_t const * key, size_t keylen)
+      : inner_(), outer_(), running_()
+    {
+      uint8_t k[block_size] = {};
+      if (keylen > block_size)
+        {
+          Hasher h;
+          h.update(key, keylen);
+          digest_type d = h.finalize();
+          for (size_t i = 0; i < digest_size; i++) k[i] = d[i];
+        }
+      else
+        {
+          for (size_t i = 0; i < keylen; i++) k[i] = key[i];
+        }
+
+      uint8_t pad[block_size] = {};
+      for (size_t i = 0; i < block_size; i++) pad[i] = k[i] ^ 0x36;
+      inner_.update(pad, block_size);
+      for (size_t i = 0; i < block_size; i++) pad[i] = k[i] ^ 0x5c;
+      outer_.update(pad, block_size);
+
+      running_ = inner_;
+    }
+
+    constexpr void update(uint8_t const * data, size_t datalen)
+    {
+      running_.update(data, datalen);
+    }
+
+    constexpr digest_type finalize()
+    {
+      digest_type d = running_.finalize();
+      uint8_t bytes[digest_size] = {};
+      for (size_t i = 0; i < digest_size; i++) bytes[i] = d[i];
+
+      Hasher o = outer_;
+      o.update(bytes, digest_size);
+      running_ = inner_;
+      return o.finalize();
+    }
+  };
+
+
+  // Number of PBKDF2 chains computed side by side. The lane loops are
+  // innermost so the compiler can keep one lane per SIMD element; eight
+  // 32-bit SHA-256 lanes fill an AVX2 register, eight 64-bit SHA-512 lanes
+  // two of them.
+  constexpr size_t pbkdf2_lanes = 8;
+
+  namespace detail
+  {
+    constexpr uint64_t rightrotate64(uint64_t a, int b) noexcept
+    {
+      return (a >> b) | (a << (64 - b));
+    }
+
+    constexpr uint64_t sha512_round_constants[80] = {
+      0x428a2f98d728ae22, 0x7137449123ef65cd, 0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc, 0x3956c25bf348b538, 0x59f111f1b605d019, 0x923f82a4af194f9b, 0xab1c5ed5da6d8118,
+      0xd807aa98a3030242, 0x12835b0145706fbe, 0x243185be4ee4b28c, 0x550c7dc3d5ffb4e2, 0x72be5d74f27b896f, 0x80deb1fe3b1696b1, 0x9bdc06a725c71235, 0xc19bf174cf692694,
+      0xe49b69c19ef14ad2, 0xefbe4786384f25e3, 0x0fc19dc68b8cd5b5, 0x240ca1cc77ac9c65, 0x2de92c6f592b0275, 0x4a7484aa6ea6e483, 0x5cb0a9dcbd41fbd4, 0x76f988da831153b5,
+      0x983e5152ee66dfab, 0xa831c66d2db43210, 0xb00327c898fb213f, 0xbf597fc7beef0ee4, 0xc6e00bf33da88fc2, 0xd5a79147930aa725, 0x06ca6351e003826f, 0x142929670a0e6e70,
+      0x27b70a8546d22ffc, 0x2e1b21385c26c926, 0x4d2c6dfc5ac42aed, 0x53380d139d95b3df, 0x650a73548baf63de, 0x766a0abb3c77b2a8, 0x81c2c92e47edaee6, 0x92722c851482353b,
+      0xa2bfe8a14cf10364, 0xa81a664bbc423001, 0xc24b8b70d0f89791, 0xc76c51a30654be30, 0xd192e819d6ef5218, 0xd69906245565a910, 0xf40e35855771202a, 0x106aa07032bbd1b8,
+      0x19a4c116b8d2d0c8, 0x1e376c085141ab53, 0x2748774cdf8eeb99, 0x34b0bcb5e19b48a8, 0x391c0cb3c5c95a63, 0x4ed8aa4ae3418acb, 0x5b9cca4f7763e373, 0x682e6ff3d6b2b8a3,
+      0x748f82ee5defb2fc, 0x78a5636f43172f60, 0x84c87814a1f0ab72, 0x8cc702081a6439ec, 0x90befffa23631e28, 0xa4506cebde82bde9, 0xbef9a3f7b2c67915, 0xc67178f2e372532b,
+      0xca273eceea26619c, 0xd186b8c721c0c207, 0xeada7dd6cde0eb1e, 0xf57d4f7fee6ed178, 0x06f067aa72176fba, 0x0a637dc5a2c898a6, 0x113f9804bef90dae, 0x1b710b35131c471b,
+      0x28db77f523047d84, 0x32caab7b40c72493, 0x3c9ebe0a15c9bebc, 0x431d67c49c100d4c, 0x4cc5d4becb3e42b6, 0x597f299cfc657e2a, 0x5fcb6fab3ad6faec, 0x6c44198c4a475817
+    };
+
+    constexpr uint64_t sha512_initial_state[8] = { 0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1, 0x510e527fade682d1, 0x9b05688c2b3e6c1f, 0x1f83d9abfb41bd6b, 0x5be0cd19137e2179 };
+
+    // L independent SHA-256 states, compressed together.
+    template <size_t L>
+    struct sha256_lanes
+    {
+      using word = uint32_t;
+      static constexpr size_t block_size = 64;
+      static constexpr uint32_t const * initial_state = sha256::initial_state;
+
+      uint32_t s[8][L];
+
+      // Compresses one block per lane, given as big endian words.
+      constexpr void compress(uint32_t const (&block)[16][L]) noexcept
+      {
+        uint32_t w[64][L] = {};
+        for (int i = 0; i < 16; i++)
+          for (size_t l = 0; l < L; l++) w[i][l] = block[i][l];
+
+        for (int i = 16; i < 64; i++)
+          for (size_t l = 0; l < L; l++)
+            {
+              uint32_t s0 = rightrotate(w[i-15][l], 7) ^ rightrotate(w[i-15][l], 18) ^ (w[i-15][l] >> 3);
+              uint32_t s1 = rightrotate(w[i-2][l], 17) ^ rightrotate(w[i-2][l], 19) ^ (w[i-2][l] >> 10);
+              w[i][l] = w[i-16][l] + s0 + w[i-7][l] + s1;
+            }
+
+        uint32_t a[L] = {}, b[L] = {}, c[L] = {}, d[L] = {}, e[L] = {}, f[L] = {}, g[L] = {}, h[L] = {};
+        for (size_t l = 0; l < L; l++)
+          {
+            a[l] = s[0][l]; b[l] = s[1][l]; c[l] = s[2][l]; d[l] = s[3][l];
+            e[l] = s[4][l]; f[l] = s[5][l]; g[l] = s[6][l]; h[l] = s[7][l];
+          }
+
+        for (int i = 0; i < 64; i++)
+          for (size_t l = 0; l < L; l++)
+            {
+              uint32_t S1 = rightrotate(e[l], 6) ^ rightrotate(e[l], 11) ^ rightrotate(e[l], 25);
+              uint32_t ch = (e[l] & f[l]) ^ (~e[l] & g[l]);
+              uint32_t temp1 = h[l] + S1 + ch + sha256::round_constants[i] + w[i][l];
+              uint32_t S0 = rightrotate(a[l], 2) ^ rightrotate(a[l], 13) ^ rightrotate(a[l], 22);
+              uint32_t maj = (a[l] & b[l]) ^ (a[l] & c[l]) ^ (b[l] & c[l]);
+
+              h[l] = g[l];
+              g[l] = f[l];
+              f[l] = e[l];
+              e[l] = d[l] + temp1;
+              d[l] = c[l];
+              c[l] = b[l];
+              b[l] = a[l];
+              a[l] = temp1 + S0 + maj;
+            }
+
+        for (size_t l = 0; l < L; l++)
+          {
+            s[0][l] += a[l]; s[1][l] += b[l]; s[2][l] += c[l]; s[3][l] += d[l];
+            s[4][l] += e[l]; s[5][l] += f[l]; s[6][l] += g[l]; s[7][l] += h[l];
+          }
+      }
+    };
+
+    // L independent SHA-512 states, compressed together.
+    template <size_t L>
+    struct sha512_lanes
+    {
+      using word = uint64_t;
+      static constexpr size_t block_size = 128;
+      static constexpr uint64_t const * initial_state = sha512_initial_state;
+
+      uint64_t s[8][L];
+
+      // Compresses one block per lane, given as big endian words.
+      constexpr void compress(uint64_t const (&block)[16][L]) noexcept
+      {
+        uint64_t w[80][L] = {};
+        for (int i = 0; i < 16; i++)
+          for (size_t l = 0; l < L; l++) w[i][l] = block[i][l];
+
+        for (int i = 16; i < 80; i++)
+          for (size_t l = 0; l < L; l++)
+            {
+              uint64_t s0 = rightrotate64(w[i-15][l], 1) ^ rightrotate64(w[i-15][l], 8) ^ (w[i-15][l] >> 7);
+              uint64_t s1 = rightrotate64(w[i-2][l], 19) ^ rightrotate64(w[i-2][l], 61) ^ (w[i-2][l] >> 6);
+              w[i][l] = w[i-16][l] + s0 + w[i-7][l] + s1;
+            }
+
+        uint64_t a[L] = {}, b[L] = {}, c[L] = {}, d[L] = {}, e[L] = {}, f[L] = {}, g[L] = {}, h[L] = {};
+        for (size_t l = 0; l < L; l++)
+          {
+            a[l] = s[0][l]; b[l] = s[1][l]; c[l] = s[2][l]; d[l] = s[3][l];
+            e[l] = s[4][l]; f[l] = s[5][l]; g[l] = s[6][l]; h[l] = s[7][l];
+          }
+
+        for (int i = 0; i < 80; i++)
+          for (size_t l = 0; l < L; l++)
+            {
+              uint64_t S1 = rightrotate64(e[l], 14) ^ rightrotate64(e[l], 18) ^ rightrotate64(e[l], 41);
+              uint64_t ch = (e[l] & f[l]) ^ (~e[l] & g[l]);
+              uint64_t temp1 = h[l] + S1 + ch + sha512_round_constants[i] + w[i][l];
+              uint64_t S0 = rightrotate64(a[l], 28) ^ rightrotate64(a[l], 34) ^ rightrotate64(a[l], 39);
+              uint64_t maj = (a[l] & b[l]) ^ (a[l] & c[l]) ^ (b[l] & c[l]);
+
+              h[l] = g[l];
+              g[l] = f[l];
+              f[l] = e[l];
+              e[l] = d[l] + temp1;
+              d[l] = c[l];
+              c[l] = b[l];
+              b[l] = a[l];
+              a[l] = temp1 + S0 + maj;
+            }
+
+        for (size_t l = 0; l < L; l++)
+          {
+            s[0][l] += a[l]; s[1][l] += b[l]; s[2][l] += c[l]; s[3][l] += d[l];
+            s[4][l] += e[l]; s[5][l] += f[l]; s[6][l] += g[l]; s[7][l] += h[l];
+          }
+      }
+    };
+
+    template <typename Word>
+    constexpr Word load_bigendian(uint8_t const * p) noexcept
+    {
+      Word w = 0;
+      for (size_t i = 0; i < sizeof(Word); i++) w = Word(w << 8) | p[i];
+      return w;
+    }
+
+    // A single lane as an incremental hasher, for the few short messages
+    // PBKDF2 hashes outside its iteration loop. Unlike sha512's hasher it
+    // is constexpr, so the derivations below can be checked at compile time.
+    template <template <size_t> class Lanes>
+    class lanes_hasher
+    {
+      using word = typename Lanes<1>::word;
+
+    public:
+      static constexpr size_t block_size = Lanes<1>::block_size;
+
+    private:
+      Lanes<1> state_;
+      uint8_t buffer_[block_size];
+      size_t buffered_;
+      uint64_t bytes_;
+
+      constexpr void compress_buffer() noexcept
+      {
+        word block[16][1] = {};
+        for (int i = 0; i < 16; i++) block[i][0] = load_bigendian<word>(buffer_ + sizeof(word) * i);
+        state_.compress(block);
+        buffered_ = 0;
+      }
+
+    public:
+      constexpr lanes_hasher() noexcept
+        : state_(), buffer_(), buffered_(0), bytes_(0)
+      {
+        for (int i = 0; i < 8; i++) state_.s[i][0] = Lanes<1>::initial_state[i];
+      }
+
+      constexpr void update(uint8_t const * data, size_t datalen) noexcept
+      {
+        bytes_ += datalen;
+        for (size_t i = 0; i < datalen; i++)
+          {
+            buffer_[buffered_++] = data[i];
+            if (buffered_ == block_size) compress_buffer();
+          }
+      }
+
+      // The length field is two words wide; only its low 64 bits are used.
+      constexpr std::array<uint8_t, 8 * sizeof(word)> finalize() noexcept
+      {
+        uint64_t bits = bytes_ * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (buffered_ != block_size - 8) update(&pad, 1);
+        for (int i = 7; i >= 0; i--)
+          {
+            uint8_t b = uint8_t(bits >> (8 * i));
+            update(&b, 1);
+          }
+
+        std::array<uint8_t, 8 * sizeof(word)> out = {};
+        for (size_t i = 0; i < out.size(); i++)
+          {
+            out[i] = uint8_t(state_.s[i / sizeof(word)][0] >> (8 * (sizeof(word) - 1 - i % sizeof(word))));
+          }
+        return out;
+      }
+    };
+
+    // One PBKDF2 output block waiting to be iterated: the HMAC midstates
+    // for its password, U1, and where the result goes.
+    template <typename Word>
+    struct pbkdf2_task
+    {
+      Word ipad[8];
+      Word opad[8];
+      Word u[8];
+      uint8_t * out;
+      size_t out_len;
+    };
+
+    template <template <size_t> class Lanes>
+    constexpr void hmac_midstate(uint8_t const * key, size_t keylen, uint8_t pad, typename Lanes<1>::word (&state)[8])
+    {
+      using word = typename Lanes<1>::word;
+      constexpr size_t B = Lanes<1>::block_size;
+
+      uint8_t k[B] = {};
+      if (keylen > B)
+        {
+          lanes_hasher<Lanes> h;
+          h.update(key, keylen);
+          auto d = h.finalize();
+          for (size_t i = 0; i < d.size(); i++) k[i] = d[i];
+        }
+      else
+        {
+          for (size_t i = 0; i < keylen; i++) k[i] = key[i];
+        }
+      for (size_t i = 0; i < B; i++) k[i] ^= pad;
+
+      Lanes<1> st = {};
+      word block[16][1] = {};
+      for (int i = 0; i < 8; i++) st.s[i][0] = Lanes<1>::initial_state[i];
+      for (int i = 0; i < 16; i++) block[i][0] = load_bigendian<word>(k + sizeof(word) * i);
+      st.compress(block);
+      for (int i = 0; i < 8; i++) state[i] = st.s[i][0];
+    }
+
+    // Prepares block `index` (1 based) of PBKDF2 for one password/salt.
+    template <template <size_t> class Lanes>
+    constexpr void pbkdf2_prepare(pbkdf2_task<typename Lanes<1>::word> & t, uint8_t const * password, size_t password_len, uint8_t const * salt, size_t salt_len, uint32_t index)
+    {
+      using word = typename Lanes<1>::word;
+
+      hmac_midstate<Lanes>(password, password_len, 0x36, t.ipad);
+      hmac_midstate<Lanes>(password, password_len, 0x5c, t.opad);
+
+      hmac<lanes_hasher<Lanes>> prf(password, password_len);
+      uint8_t be_index[4] = { uint8_t(index >> 24), uint8_t(index >> 16), uint8_t(index >> 8), uint8_t(index) };
+      prf.update(salt, salt_len);
+      prf.update(be_index, 4);
+      auto u = prf.finalize();
+      for (int i = 0; i < 8; i++) t.u[i] = load_bigendian<word>(u.data() + sizeof(word) * i);
+    }
+
+    // Runs iterations 2..c for up to L tasks at once and writes the results.
+    // Each iteration is two compressions per lane: the inner hash of U
+    // from the ipad midstate and the outer hash from the opad midstate.
+    template <template <size_t> class Lanes, size_t L>
+    constexpr void pbkdf2_iterate(pbkdf2_task<typename Lanes<1>::word> * tasks, size_t n, uint64_t iterations)
+    {
+      using word = typename Lanes<1>::word;
+
+      word ipad[8][L] = {}, opad[8][L] = {}, u[8][L] = {}, t[8][L] = {};
+      for (size_t l = 0; l < L; l++)
+        {
+          // Spare lanes repeat the first task; their results are dropped.
+          pbkdf2_task<word> const & task = tasks[l < n ? l : 0];
+          for (int i = 0; i < 8; i++)
+            {
+              ipad[i][l] = task.ipad[i];
+              opad[i][l] = task.opad[i];
+              u[i][l] = t[i][l] = task.u[i];
+            }
+        }
+
+      // U is always one digest, so the padding of both blocks is fixed:
+      // a block of key pad plus eight words of message.
+      word block[16][L] = {};
+      for (size_t l = 0; l < L; l++)
+        {
+          block[8][l] = word(1) << (8 * sizeof(word) - 1);
+          block[15][l] = (Lanes<1>::block_size + 8 * sizeof(word)) * 8;
+        }
+
+      Lanes<L> st = {};
+      for (uint64_t j = 1; j < iterations; j++)
+        {
+          for (int i = 0; i < 8; i++)
+            for (size_t l = 0; l < L; l++)
+              {
+                st.s[i][l] = ipad[i][l];
+                block[i][l] = u[i][l];
+              }
+          st.compress(block);
+
+          for (int i = 0; i < 8; i++)
+            for (size_t l = 0; l < L; l++)
+              {
+                block[i][l] = st.s[i][l];
+                st.s[i][l] = opad[i][l];
+              }
+          st.compress(block);
+
+          for (int i = 0; i < 8; i++)
+            for (size_t l = 0; l < L; l++)
+              {
+                u[i][l] = st.s[i][l];
+                t[i][l] ^= u[i][l];
+              }
+        }
+
+      for (size_t l = 0; l < L && l < n; l++)
+        {
+          for (size_t i = 0; i < tasks[l].out_len; i++)
+            {
+              tasks[l].out[i] = uint8_t(t[i / sizeof(word)][l] >> (8 * (sizeof(word) - 1 - i % sizeof(word))));
+            }
+        }
+    }
+
+    // Iterates n <= pbkdf2_lanes tasks in the narrowest lane count that
+    // holds them. Without AVX2 a lane costs about as much as a whole SSE2
+    // register of them, so a single derivation must not pay for eight.
+    template <template <size_t> class Lanes>
+    constexpr void pbkdf2_iterate_fit(pbkdf2_task<typename Lanes<1>::word> * tasks, size_t n, uint64_t iterations)
+    {
+      if (n <= 1) pbkdf2_iterate<Lanes, 1>(tasks, n, iterations);
+      else if (n <= 2) pbkdf2_iterate<Lanes, 2>(tasks, n, iterations);
+      else if (n <= 4) pbkdf2_iterate<Lanes, 4>(tasks, n, iterations);
+      else pbkdf2_iterate<Lanes, pbkdf2_lanes>(tasks, n, iterations);
+    }
+
+    template <template <size_t> class Lanes>
+    constexpr void pbkdf2_lanes_derive(uint8_t const * password, size_t password_len, uint8_t const * salt, size_t salt_len, uint64_t iterations, uint8_t * out, size_t out_len)
+    {
+      constexpr size_t hlen = 8 * sizeof(typename Lanes<1>::word);
+
+      uint32_t index = 1;
+      while (out_len != 0)
+        {
+          pbkdf2_task<typename Lanes<1>::word> tasks[pbkdf2_lanes] = {};
+          size_t n = 0;
+          for (; n < pbkdf2_lanes && out_len != 0; n++, index++)
+            {
+              pbkdf2_prepare<Lanes>(tasks[n], password, password_len, salt, salt_len, index);
+              tasks[n].out = out;
+              tasks[n].out_len = std::min(out_len, hlen);
+              out += tasks[n].out_len;
+              out_len -= tasks[n].out_len;
+            }
+          pbkdf2_iterate_fit<Lanes>(tasks, n, iterations);
+        }
+    }
+  }
+
+
+  // PBKDF2 (RFC 8018) with HMAC over Hasher.
+  //
+  // For SHA-256 and SHA-512 the output blocks are iterated side by side in
+  // up to pbkdf2_lanes SIMD lanes from precomputed HMAC midstates. Other
+  // hashers reuse hmac's midstates one block at a time.
+  template <typename Hasher>
+  constexpr void pbkdf2(uint8_t const * password, size_t password_len, uint8_t const * salt, size_t salt_len, uint64_t iterations, uint8_t * out, size_t out_len)
+  {
+    constexpr size_t hlen = hmac<Hasher>::digest_size;
+
+    if constexpr (std::is_same<Hasher, sha256::incremental_hasher>::value)
+      {
+        detail::pbkdf2_lanes_derive<detail::sha256_lanes>(password, password_len, salt, salt_len, iterations, out, out_len);
+      }
+    else if constexpr (std::is_same<Hasher, sha512::incremental_hasher>::value)
+      {
+        detail::pbkdf2_lanes_derive<detail::sha512_lanes>(password, password_len, salt, salt_len, iterations, out, out_len);
+      }
+    else
+      {
+        hmac<Hasher> prf(password, password_len);
+        for (uint32_t index = 1; out_len != 0; index++)
+          {
+            uint8_t be_index[4] = { uint8_t(index >> 24), uint8_t(index >> 16), uint8_t(index >> 8), uint8_t(index) };
+            prf.update(salt, salt_len);
+            prf.update(be_index, 4);
+            auto u = prf.finalize();
+
+            uint8_t t[hlen] = {};
+            uint8_t ub[hlen] = {};
+            for (size_t i = 0; i < hlen; i++) t[i] = ub[i] = u[i];
+
+            for (uint64_t j = 1; j < iterations; j++)
+              {
+                prf.update(ub, hlen);
+                u = prf.finalize();
+                for (size_t i = 0; i < hlen; i++)
+                  {
+                    ub[i] = u[i];
+                    t[i] ^= ub[i];
+                  }
+              }
+
+            size_t n = std::min(out_len, hlen);
+            for (size_t i = 0; i < n; i++) out[i] = t[i];
+            out += n;
+            out_len -= n;
+          }
+      }
+  }
+
+  struct pbkdf2_job
+  {
+    uint8_t const * password;
+    size_t password_len;
+    uint8_t const * salt;
+    size_t salt_len;
+    uint8_t * out;
+    size_t out_len;
+  };
+
+  namespace detail
+  {
+    template <template <size_t> class Lanes>
+    void pbkdf2_batch(pbkdf2_job const * jobs, size_t n, uint64_t iterations, unsigned threads)
+    {
+      constexpr size_t hlen = 8 * sizeof(typename Lanes<1>::word);
+
+      std::vector<pbkdf2_task<typename Lanes<1>::word>> tasks;
+      for (size_t j = 0; j < n; j++)
+        {
+          size_t done = 0;
+          for (uint32_t index = 1; done < jobs[j].out_len; index++)
+            {
+              pbkdf2_task<typename Lanes<1>::word> t = {};
+              pbkdf2_prepare<Lanes>(t, jobs[j].password, jobs[j].password_len, jobs[j].salt, jobs[j].salt_len, index);
+              t.out = jobs[j].out + done;
+              t.out_len = std::min(jobs[j].out_len - done, hlen);
+              done += t.out_len;
+              tasks.push_back(t);
+            }
+        }
+
+      size_t groups = (tasks.size() + pbkdf2_lanes - 1) / pbkdf2_lanes;
+      parallel_for(0, groups, threads, [&](size_t g)
+        {
+          size_t first = g * pbkdf2_lanes;
+          pbkdf2_iterate_fit<Lanes>(tasks.data() + first, std::min(pbkdf2_lanes, tasks.size() - first), iterations);
+        });
+    }
+  }
+
+  // PBKDF2-HMAC-SHA256 for many independent passwords with the same
+  // iteration count, e.g. concurrent logins. Every output block of every job
+  // becomes one SIMD lane, so up to pbkdf2_lanes of them cost about the
+  // same as one. Groups of lanes are spread over `threads` threads (0 means
+  // one per hardware thread).
+  inline void pbkdf2_hmac_sha256_batch(pbkdf2_job const * jobs, size_t n, uint64_t iterations, unsigned threads = 1)
+  {
+    detail::pbkdf2_batch<detail::sha256_lanes>(jobs, n, iterations, threads);
+  }
+
+  // As pbkdf2_hmac_sha256_batch, with HMAC-SHA512.
+  inline void pbkdf2_hmac_sha512_batch(pbkdf2_job const * jobs, size_t n, uint64_t iterations, unsigned threads = 1)
+  {
+    detail::pbkdf2_batch<detail::sha512_lanes>(jobs, n, iterations, threads);
+  }
+
+
+  // HKDF (RFC 5869) with HMAC over Hasher.
+
+  // An empty salt is the same as HashLen zero bytes, since HMAC zero pads
+  // the key either way.
+  template <typename Hasher>
+  constexpr auto hkdf_extract(uint8_t const * salt, size_t salt_len, uint8_t const * ikm, size_t ikm_len)
+  {
+    hmac<Hasher> h(salt, salt_len);
+    h.update(ikm, ikm_len);
+    return h.finalize();
+  }
+
+  template <typename Hasher>
+  constexpr void hkdf_expand(uint8_t const * prk, size_t prk_len, uint8_t const * info, size_t info_len, uint8_t * out, size_t out_len)
+  {
+    constexpr size_t hlen = hmac<Hasher>::digest_size;
+    if (out_len > 255 * hlen) throw std::invalid_argument("iev::hkdf_expand: output too long");
+
+    hmac<Hasher> h(prk, prk_len);
+    uint8_t t[hlen] = {};
+    size_t t_len = 0;
+    for (uint8_t counter = 1; out_len != 0; counter++)
+      {
+        h.update(t, t_len);
+        h.update(info, info_len);
+        h.update(&counter, 1);
+        auto d = h.finalize();
+        for (size_t i = 0; i < hlen; i++) t[i] = d[i];
+        t_len = hlen;
+
+        size_t n = std::min(out_len, hlen);
+        for (size_t i = 0; i < n; i++) out[i] = t[i];
+        out += n;
+        out_len -= n;
+      }
+  }
+
+  template <typename Hasher>
+  constexpr void hkdf(uint8_t const * salt, size_t salt_len, uint8_t const * ikm, size_t ikm_len, uint8_t const * info, size_t info_len, uint8_t * out, size_t out_len)
+  {
+    auto prk = hkdf_extract<Hasher>(salt, salt_len, ikm, ikm_len);
+    uint8_t bytes[hmac<Hasher>::digest_size] = {};
+    for (size_t i = 0; i < sizeof(bytes); i++) bytes[i] = prk[i];
+    hkdf_expand<Hasher>(bytes, sizeof(bytes), info, info_len, out, out_len);
+  }
+
+
+  namespace detail
+  {
+    template <size_t N>
+    constexpr size_t kdf_test_load(char const * text, uint8_t (&out)[N])
+    {
+      size_t n = 0;
+      for (; text[n] != '\0'; n++) out[n] = uint8_t(text[n]);
+      return n;
+    }
+
+    template <size_t N>
+    constexpr bool kdf_test_equal(uint8_t const * bytes, char const (&hex)[N])
+    {
+      for (size_t i = 0; i < (N - 1) / 2; i++)
+        {
+          if (bytes[i] != ((hex_value(hex[2*i]) << 4) | hex_value(hex[2*i+1]))) return false;
+        }
+      return true;
+    }
+
+    template <typename Hasher, size_t N>
+    constexpr bool pbkdf2_test(char const * password, char const * salt, uint64_t iterations, char const (&hex)[N])
+    {
+      uint8_t p[64] = {}, s[64] = {}, out[(N - 1) / 2] = {};
+      size_t plen = kdf_test_load(password, p);
+      size_t slen = kdf_test_load(salt, s);
+      pbkdf2<Hasher>(p, plen, s, slen, iterations, out, sizeof(out));
+      return kdf_test_equal(out, hex);
+    }
+
+    // A password of `length` 'k's, longer than a block so HMAC hashes it.
+    template <typename Hasher, size_t N>
+    constexpr bool pbkdf2_long_key_test(size_t length, char const (&hex)[N])
+    {
+      uint8_t p[256] = {}, s[4] = { 's', 'a', 'l', 't' }, out[(N - 1) / 2] = {};
+      for (size_t i = 0; i < length; i++) p[i] = 'k';
+      pbkdf2<Hasher>(p, length, s, sizeof(s), 2, out, sizeof(out));
+      return kdf_test_equal(out, hex);
+    }
+
+    // RFC 6070 inputs with HMAC-SHA256.
+    static_assert(pbkdf2_test<sha256::incremental_hasher>("password", "salt", 1, "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b"));
+    static_assert(pbkdf2_test<sha256::incremental_hasher>("password", "salt", 2, "ae4d0c95af6b46d32d0adff928f06dd02a303f8ef3c251dfd6e2d85a95474c43"));
+    static_assert(pbkdf2_long_key_test<sha256::incremental_hasher>(100, "2c1357648009149f57e4d5544c3435bbca87a6b231300fa3abb2a89b50f56ec3eb3e22ce8267e0fe"));
+
+    // RFC 7914 section 11.
+    static_assert(pbkdf2_test<sha256::incremental_hasher>("passwd", "salt", 1, "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783"));
+
+    // RFC 6070 inputs with HMAC-SHA512; the 150 byte output spans three
+    // lanes, the last one partial.
+    static_assert(pbkdf2_test<sha512::incremental_hasher>("password", "salt", 1, "867f70cf1ade02cff3752599a3a53dc4af34c7a669815ae5d513554e1c8cf252c02d470a285a0501bad999bfe943c08f050235d7d68b1da55e63f73b60a57fce"));
+    static_assert(pbkdf2_test<sha512::incremental_hasher>("password", "salt", 2, "e1d9c16aa681708a45f5c7c4e215ceb66e011a2e9f0040713f18aefdb866d53cf76cab2868a39b9f7840edce4fef5a82be67335c77a6068e04112754f27ccf4e"));
+    static_assert(pbkdf2_test<sha512::incremental_hasher>("passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt", 3, "e3ad582d92516a866ef6a2725080fbee6f7cd51734047789cccdae6581e79529601c42bf26261838b697a3a819e36dab84f1987867fc40a605429d6c540e3cb223551306ab87c412d04ce40f3def06757fe3789fdcf8e2ad8e4343427a94fe8224aa48bbc9eb3039c3a2fe2508193d1cce542f28ad01b2515ed32c60426200e14bcf3571f42a5d9343ffce60f948468a29ac976d1a57"));
+    static_assert(pbkdf2_long_key_test<sha512::incremental_hasher>(200, "e9fdd588175bf1523fceae5699825fa91b8e5c2b796e192cc57063f74429c5a2fe28280f3ccd306ea19f4156e7cbaff46548d06a47969f58d1e933f7957829fc"));
+
+    // RFC 5869 A.1 inputs.
+    template <typename Hasher, size_t P, size_t O>
+    constexpr bool hkdf_test(char const (&prk_hex)[P], char const (&okm_hex)[O])
+    {
+      uint8_t ikm[22] = {}, salt[13] = {}, info[10] = {}, okm[42] = {};
+      for (size_t i = 0; i < sizeof(ikm); i++) ikm[i] = 0x0b;
+      for (size_t i = 0; i < sizeof(salt); i++) salt[i] = i;
+      for (size_t i = 0; i < sizeof(info); i++) info[i] = 0xf0 + i;
+
+      auto prk = hkdf_extract<Hasher>(salt, sizeof(salt), ikm, sizeof(ikm));
+      uint8_t prk_bytes[hmac<Hasher>::digest_size] = {};
+      for (size_t i = 0; i < sizeof(prk_bytes); i++) prk_bytes[i] = prk[i];
+      hkdf_expand<Hasher>(prk_bytes, sizeof(prk_bytes), info, sizeof(info), okm, sizeof(okm));
+
+      return kdf_test_equal(prk_bytes, prk_hex) && kdf_test_equal(okm, okm_hex);
+    }
+
+    static_assert(hkdf_test<sha256::incremental_hasher>("077709362c2e32df0ddc3f0dc47bba6390b6c73bb50f9c3122ec844ad7c2b3e5", "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865"));
+
+    // sha512's hasher is not constexpr; the single lane one computes the
+    // same function.
+    static_assert(hkdf_test<lanes_hasher<sha512_lanes>>("665799823737ded04a88e47e54a5890bb2c3d247c7a4254a8e61350723590a26c36238127d8661b88cf80ef802d57e2f7cebcf1e00e083848be19929c61b4237", "832390086cda71fb47625bb5ceb168e4c8e26a1a16ed34d9fc7fe92c1481579338da362cb8d9f925d7cb"));
+  }
+}
+
+#endif
@@ -0,0 +1,384 @@
+/*
+
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef IEV_HASH_MANIFEST_HH
+#define IEV_HASH_MANIFEST_HH
+
+#include "detail.hh"
+#include "parallel.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <inttypes.h>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace iev
+{
+  // Chunked digest manifest.
+  //
+  // A file is split into fixed size chunks which are hashed independently, so
+  // any byte range can be verified by rehashing only the chunks it touches.
+  // Hasher is any of the incremental hashers in this library
+  // (sha256::incremental_hasher, sha512::incremental_hasher,
+  // blake2b<N>::incremental_hasher).
+  //
+  // On disk layout, all integers little endian:
+  //
+  //    0  magic "IEVCHNK1"
+  //    8  u32 digest size
+  //   12  u32 algorithm id (1 sha256, 2 sha512, 0x100 + bits blake2b)
+  //   16  u64 chunk size
+  //   24  u64 total size
+  //   32  u64 chunk count
+  //   40  u64 reserved, zero
+  //   48  root digest
+  //   48 + digest_size * (1 + i)  digest of chunk i
+  //
+  // The root digest is the hash of bytes 16..40 of the header followed by all
+  // chunk digests in order. Chunk lookups are a fixed offset into the file so
+  // a manifest can be used directly from an mmap.
+  template <typename Hasher>
+  class chunk_manifest
+  {
+  public:
+    using digest_type = detail::digest_of<Hasher>;
+
+    static constexpr size_t digest_size = sizeof(digest_type);
+    static constexpr size_t header_size = 48;
+
+  private:
+    static constexpr char magic[8] = { 'I', 'E', 'V', 'C', 'H', 'N', 'K', '1' };
+    static constexpr uint32_t algorithm = detail::digest_algorithm<digest_type>::value;
+
+    static void store_digest(uint8_t * x, digest_type const & d)
+    {
+      std::copy(d.begin(), d.end(), x);
+    }
+
+    static digest_type load_digest(uint8_t const * x)
+    {
+      digest_type d;
+      std::copy(x, x + digest_size, d.begin());
+      return d;
+    }
+
+    static digest_type hash_bytes(uint8_t const * data, size_t len)
+    {
+      Hasher h;
+      h.update(data, len);
+      return h.finalize();
+    }
+
+    static uint64_t file_size(int fd)
+    {
+      struct stat st;
+      if (::fstat(fd, &st) != 0) throw std::system_error(errno, std::system_category(), "fstat");
+      return st.st_size;
+    }
+
+  public:
+
+    // Read only view of a serialized manifest. The view does not own the
+    // bytes; they must outlive it.
+    class view
+    {
+      uint8_t const * base_;
+      size_t length_;
+
+    protected:
+      view() noexcept
+        : base_(nullptr), length_(0)
+      {
+      }
+
+      void reset(uint8_t const * base, size_t length)
+      {
+        if (length < header_size + digest_size
+            || std::memcmp(base, magic, sizeof(magic)) != 0
+            || detail::load_littleendian32(base + 8) != digest_size
+            || detail::load_littleendian32(base + 12) != algorithm)
+          {
+            throw std::invalid_argument("iev::chunk_manifest: not a manifest for this digest");
+          }
+
+        uint64_t chunk = detail::load_littleendian64(base + 16);
+        uint64_t total = detail::load_littleendian64(base + 24);
+        uint64_t count = detail::load_littleendian64(base + 32);
+
+        if (chunk == 0
+            || count != total / chunk + (total % chunk != 0)
+            || count > (length - header_size) / digest_size - 1
+            || length != header_size + digest_size * (count + 1))
+          {
+            throw std::invalid_argument("iev::chunk_manifest: corrupt header");
+          }
+
+        base_ = base;
+        length_ = length;
+      }
+
+    public:
+      view(uint8_t const * base, size_t length)
+      {
+        reset(base, length);
+      }
+
+      uint8_t const * data() const noexcept { return base_; }
+      size_t size() const noexcept { return length_; }
+
+      uint64_t chunk_size() const noexcept { return detail::load_littleendian64(base_ + 16); }
+      uint64_t total_size() const noexcept { return detail::load_littleendian64(base_ + 24); }
+      uint64_t chunk_count() const noexcept { return detail::load_littleendian64(base_ + 32); }
+
+      digest_type root() const
+      {
+        return load_digest(base_ + header_size);
+      }
+
+      digest_type chunk(uint64_t i) const
+      {
+        return load_digest(chunk_data(i));
+      }
+
+      uint8_t const * chunk_data(uint64_t i) const noexcept
+      {
+        return base_ + header_size + digest_size * (i + 1);
+      }
+
+      uint64_t chunk_offset(uint64_t i) const noexcept
+      {
+        return i * chunk_size();
+      }
+
+      uint64_t chunk_length(uint64_t i) const noexcept
+      {
+        return std::min(chunk_size(), total_size() - chunk_offset(i));
+      }
+
+      // Half open range of chunk indices overlapping [offset, offset + length).
+      std::pair<uint64_t, uint64_t> chunks_for(uint64_t offset, uint64_t length) const noexcept
+      {
+        uint64_t total = total_size();
+        if (offset >= total || length == 0) return { 0, 0 };
+        uint64_t last = std::min(total - offset, length) + offset;
+        uint64_t chunk = chunk_size();
+        return { offset / chunk, last / chunk + (last % chunk != 0) };
+      }
+
+      // True if the root digest matches the chunk digests. This only rehashes
+      // the manifest itself, not the data.
+      bool consistent() const
+      {
+        Hasher h;
+        h.update(base_ + 16, 24);
+        h.update(chunk_data(0), digest_size * chunk_count());
+        return h.finalize() == root();
+      }
+    };
+
+    // A manifest file mapped read only into memory.
+    class mapped
+      : public view
+    {
+      void * map_;
+      size_t map_length_;
+
+    public:
+      explicit mapped(char const * path)
+        : map_(MAP_FAILED), map_length_(0)
+      {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) throw std::system_error(errno, std::system_category(), path);
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+          {
+            int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::system_category(), path);
+          }
+
+        map_length_ = st.st_size;
+        if (map_length_ != 0) map_ = ::mmap(nullptr, map_length_, PROT_READ, MAP_SHARED, fd, 0);
+        int e = errno;
+        ::close(fd);
+        if (map_ == MAP_FAILED) throw std::system_error(map_length_ ? e : EINVAL, std::system_category(), path);
+
+        try
+          {
+            this->reset(static_cast<uint8_t const *>(map_), map_length_);
+          }
+        catch (...)
+          {
+            ::munmap(map_, map_length_);
+            throw;
+          }
+      }
+
+      mapped(mapped const &) = delete;
+      mapped & operator=(mapped const &) = delete;
+
+      ~mapped()
+      {
+        ::munmap(map_, map_length_);
+      }
+    };
+
+
+    // Builds a manifest for `len` bytes at `data`, hashing chunks on up to
+    // `threads` threads (0 means one per hardware thread).
+    static std::vector<uint8_t> build(uint8_t const * data, uint64_t len, uint64_t chunk_size, unsigned threads = 0)
+    {
+      std::vector<uint8_t> out = make_header(len, chunk_size);
+      uint64_t count = detail::load_littleendian64(out.data() + 32);
+
+      parallel_for(0, count, threads, [&](size_t i)
+        {
+          uint64_t offset = i * chunk_size;
+          uint64_t n = std::min(chunk_size, len - offset);
+          store_digest(out.data() + header_size + digest_size * (i + 1), hash_bytes(data + offset, n));
+        });
+
+      seal(out);
+      return out;
+    }
+
+    // Builds a manifest for the whole of the file open on `fd`. Each worker
+    // reads its chunks with pread, so the descriptor's offset is untouched.
+    static std::vector<uint8_t> build(int fd, uint64_t chunk_size, unsigned threads = 0)
+    {
+      uint64_t len = file_size(fd);
+      std::vector<uint8_t> out = make_header(len, chunk_size);
+      uint64_t count = detail::load_littleendian64(out.data() + 32);
+
+      hash_file_chunks(fd, len, chunk_size, 0, count, threads, [&](uint64_t i, digest_type const * d)
+        {
+          if (!d) throw std::system_error(EIO, std::system_category(), "iev::chunk_manifest: file shrank while hashing");
+          store_digest(out.data() + header_size + digest_size * (i + 1), *d);
+        });
+
+      seal(out);
+      return out;
+    }
+
+    // Returns the indices of chunks in [offset, offset + length) whose
+    // contents do not match the manifest. `data` is the start of the whole
+    // file image (typically an mmap of it) and must be at least
+    // m.total_size() bytes; only the affected chunks are read.
+    static std::vector<uint64_t> verify_range(view const & m, uint8_t const * data, uint64_t offset, uint64_t length, unsigned threads = 0)
+    {
+      auto range = m.chunks_for(offset, length);
+      std::vector<uint8_t> bad(range.second - range.first, 0);
+
+      parallel_for(range.first, range.second, threads, [&](size_t i)
+        {
+          digest_type d = hash_bytes(data + m.chunk_offset(i), m.chunk_length(i));
+          bad[i - range.first] = std::memcmp(&*d.begin(), m.chunk_data(i), digest_size) != 0;
+        });
+
+      return collect(bad, range.first);
+    }
+
+    // As above, reading the affected chunks from `fd` with pread. A chunk
+    // that the file ends before or inside of is reported as bad, so this
+    // also finds the ranges still missing from a partially downloaded file.
+    static std::vector<uint64_t> verify_range(view const & m, int fd, uint64_t offset, uint64_t length, unsigned threads = 0)
+    {
+      auto range = m.chunks_for(offset, length);
+      std::vector<uint8_t> bad(range.second - range.first, 0);
+
+      hash_file_chunks(fd, m.total_size(), m.chunk_size(), range.first, range.second, threads, [&](uint64_t i, digest_type const * d)
+        {
+          bad[i - range.first] = !d || std::memcmp(&*d->begin(), m.chunk_data(i), digest_size) != 0;
+        });
+
+      return collect(bad, range.first);
+    }
+
+    static std::vector<uint64_t> verify(view const & m, uint8_t const * data, unsigned threads = 0)
+    {
+      return verify_range(m, data, 0, m.total_size(), threads);
+    }
+
+    static std::vector<uint64_t> verify(view const & m, int fd, unsigned threads = 0)
+    {
+      return verify_range(m, fd, 0, m.total_size(), threads);
+    }
+
+  private:
+    static std::vector<uint8_t> make_header(uint64_t len, uint64_t chunk_size)
+    {
+      if (chunk_size == 0) throw std::invalid_argument("iev::chunk_manifest: chunk size must be non-zero");
+
+      uint64_t count = len / chunk_size + (len % chunk_size != 0);
+      std::vector<uint8_t> out(header_size + digest_size * (count + 1), 0);
+      std::memcpy(out.data(), magic, sizeof(magic));
+      detail::store_littleendian32(out.data() + 8, digest_size);
+      detail::store_littleendian32(out.data() + 12, algorithm);
+      detail::store_littleendian64(out.data() + 16, chunk_size);
+      detail::store_littleendian64(out.data() + 24, len);
+      detail::store_littleendian64(out.data() + 32, count);
+      return out;
+    }
+
+    static void seal(std::vector<uint8_t> & out)
+    {
+      Hasher h;
+      h.update(out.data() + 16, 24);
+      h.update(out.data() + header_size + digest_size, out.size() - header_size - digest_size);
+      store_digest(out.data() + header_size, h.finalize());
+    }
+
+    // Calls f(i, &digest) for each chunk in [first, last), or f(i, nullptr)
+    // if the file ends before the chunk does.
+    template <typename F>
+    static void hash_file_chunks(int fd, uint64_t len, uint64_t chunk_size, uint64_t first, uint64_t last, unsigned threads, F && f)
+    {
+      // One scratch buffer per worker, reused across the chunks it takes
+      // and released on return.
+      std::vector<std::vector<uint8_t>> bufs(parallel_threads(first, last, threads));
+      parallel_for_workers(first, last, threads, [&](unsigned w, size_t i)
+        {
+          std::vector<uint8_t> & buf = bufs[w];
+          uint64_t offset = i * chunk_size;
+          uint64_t n = std::min(chunk_size, len - offset);
+          if (buf.size() < n) buf.resize(n);
+          if (detail::read_at(fd, buf.data(), n, offset) != n)
+            {
+              f(i, nullptr);
+              return;
+            }
+          digest_type d = hash_bytes(buf.data(), n);
+          f(i, &d);
+        });
+    }
+
+    static std::vector<uint64_t> collect(std::vector<uint8_t> const & bad, uint64_t first)
+    {
+      std::vector<uint64_t> out;
+      for (size_t i = 0; i < bad.size(); i++)
+        {
+          if (bad[i]) out.push_back(first + i);
+        }
+      return out;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,95 @@
+/* 
+ 
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef IEV_HASH_PARALLEL_HH
+#define IEV_HASH_PARALLEL_HH
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace iev
+{
+  // Number of threads parallel_for(first, last, threads, ...) runs on.
+  inline unsigned parallel_threads(size_t first, size_t last, unsigned threads)
+  {
+    if (first >= last) return 0;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    if (threads > last - first) threads = last - first;
+    return threads;
+  }
+
+  // Calls f(worker, i) for every i in [first, last) using up to `threads`
+  // worker threads (0 means one per hardware thread). `worker` is in
+  // [0, parallel_threads(first, last, threads)) and identifies the calling
+  // thread, so per thread scratch can live in an array owned by the caller.
+  // Indices are handed out one at a time so uneven work items still
+  // balance. The first exception thrown by f is rethrown on the calling
+  // thread after all workers have stopped.
+  template <typename F>
+  void parallel_for_workers(size_t first, size_t last, unsigned threads, F && f)
+  {
+    threads = parallel_threads(first, last, threads);
+    if (threads == 0) return;
+
+    std::atomic<size_t> next(first);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex error_lock;
+
+    auto worker = [&](unsigned w)
+      {
+        try
+          {
+            for (size_t i = next++; i < last && !failed; i = next++)
+              {
+                f(w, i);
+              }
+          }
+        catch (...)
+          {
+            std::lock_guard<std::mutex> lock(error_lock);
+            if (!error) error = std::current_exception();
+            failed = true;
+          }
+      };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    try
+      {
+        for (unsigned i = 1; i < threads; i++) pool.emplace_back(worker, i);
+      }
+    catch (...)
+      {
+        // Stop the workers already started; destroying them joinable would
+        // call std::terminate.
+        failed = true;
+        for (auto & t : pool) t.join();
+        throw;
+      }
+    worker(0);
+    for (auto & t : pool) t.join();
+
+    if (error) std::rethrow_exception(error);
+  }
+
+  // As parallel_for_workers, calling f(i).
+  template <typename F>
+  void parallel_for(size_t first, size_t last, unsigned threads, F && f)
+  {
+    parallel_for_workers(first, last, threads, [&](unsigned, size_t i) { f(i); });
+  }
+}
+
+#endif
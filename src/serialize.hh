@@ -0,0 +1,314 @@
+/*
+
+ Copyright 2017, Ryan Nicholl <r.p.nicholl@gmail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef IEV_HASH_SERIALIZE_HH
+#define IEV_HASH_SERIALIZE_HH
+
+#include <array>
+#include <cstring>
+#include <inttypes.h>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace iev
+{
+  // Canonical serialization for hashing.
+  //
+  // serialize(value, sink) writes a value in a fixed, platform independent
+  // form:
+  //
+  //   integers, enums, bool   little endian, at their own width
+  //   T[N], std::array        the N elements, no length
+  //   strings, vectors        u64 little endian element count, then elements
+  //   pairs, tuples           the elements in order
+  //   digests                 their bytes
+  //
+  // User types opt in by providing `template <typename Sink> void
+  // serialize(T const &, Sink &)` in their own namespace, found by ADL.
+  //
+  // The usual sink is serial_sink, which stages small writes in a buffer on
+  // the stack and feeds it to a hasher's update(), so hashing an object takes
+  // one pass and never allocates. Arrays of integers are written as one
+  // span where the in-memory layout already is the canonical one.
+
+  template <typename Hasher, size_t N = 256>
+  class serial_sink
+  {
+    Hasher & hasher_;
+    size_t used_;
+    uint8_t buffer_[N];
+
+  public:
+    explicit serial_sink(Hasher & hasher) noexcept
+      : hasher_(hasher), used_(0)
+    {
+    }
+
+    serial_sink(serial_sink const &) = delete;
+    serial_sink & operator=(serial_sink const &) = delete;
+
+    ~serial_sink()
+    {
+      flush();
+    }
+
+    void write(uint8_t const * data, size_t len)
+    {
+      if (used_ + len <= N)
+        {
+          std::memcpy(buffer_ + used_, data, len);
+          used_ += len;
+          return;
+        }
+
+      flush();
+      if (len >= N)
+        {
+          hasher_.update(data, len);
+          return;
+        }
+
+      std::memcpy(buffer_, data, len);
+      used_ = len;
+    }
+
+    void flush()
+    {
+      if (used_ != 0) hasher_.update(buffer_, used_);
+      used_ = 0;
+    }
+  };
+
+
+  namespace detail
+  {
+    constexpr bool little_endian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+    // True if an array of T in memory is already in canonical form.
+    template <typename T>
+    constexpr bool raw_serializable = std::is_integral<T>::value && !std::is_same<T, bool>::value && (sizeof(T) == 1 || little_endian);
+
+    template <typename Sink>
+    constexpr void serialize_length(size_t n, Sink & sink);
+  }
+
+  template <typename T, typename Sink>
+  constexpr typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+  serialize(T const & input, Sink & output);
+
+  template <typename T, size_t N, typename Sink>
+  constexpr void serialize(T const (&input)[N], Sink & output);
+
+  template <typename T, size_t N, typename Sink>
+  constexpr void serialize(std::array<T, N> const & input, Sink & output);
+
+  template <typename C, typename Traits, typename Sink>
+  constexpr void serialize(std::basic_string_view<C, Traits> input, Sink & output);
+
+  template <typename C, typename Traits, typename Alloc, typename Sink>
+  void serialize(std::basic_string<C, Traits, Alloc> const & input, Sink & output);
+
+  template <typename T, typename Alloc, typename Sink>
+  void serialize(std::vector<T, Alloc> const & input, Sink & output);
+
+  template <typename A, typename B, typename Sink>
+  constexpr void serialize(std::pair<A, B> const & input, Sink & output);
+
+  template <typename ... Ts, typename Sink>
+  constexpr void serialize(std::tuple<Ts...> const & input, Sink & output);
+
+  namespace detail
+  {
+    // Constant evaluation cannot look at the bytes of an object, so it
+    // always takes the per-element path.
+    template <typename T, typename Sink>
+    constexpr void serialize_span(T const * data, size_t n, Sink & output)
+    {
+      if constexpr (raw_serializable<T>)
+        {
+          if (!__builtin_is_constant_evaluated())
+            {
+              output.write(reinterpret_cast<uint8_t const *>(data), n * sizeof(T));
+              return;
+            }
+        }
+      for (size_t i = 0; i < n; i++) serialize(data[i], output);
+    }
+
+    template <typename Sink>
+    constexpr void serialize_length(size_t n, Sink & sink)
+    {
+      serialize(uint64_t(n), sink);
+    }
+  }
+
+
+  template <typename T, typename Sink>
+  constexpr typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+  serialize(T const & input, Sink & output)
+  {
+    if constexpr (std::is_enum<T>::value)
+      {
+        serialize(static_cast<typename std::underlying_type<T>::type>(input), output);
+      }
+    else if constexpr (std::is_same<T, bool>::value)
+      {
+        uint8_t b = input ? 1 : 0;
+        output.write(&b, 1);
+      }
+    else
+      {
+        using U = typename std::make_unsigned<T>::type;
+        U u = static_cast<U>(input);
+        uint8_t bytes[sizeof(T)] = {};
+        for (size_t i = 0; i < sizeof(T); i++, u = U(u >> 8)) bytes[i] = uint8_t(u);
+        output.write(bytes, sizeof(T));
+      }
+  }
+
+  template <typename T, size_t N, typename Sink>
+  constexpr void serialize(T const (&input)[N], Sink & output)
+  {
+    detail::serialize_span(input, N, output);
+  }
+
+  template <typename T, size_t N, typename Sink>
+  constexpr void serialize(std::array<T, N> const & input, Sink & output)
+  {
+    detail::serialize_span(input.data(), N, output);
+  }
+
+  template <typename C, typename Traits, typename Sink>
+  constexpr void serialize(std::basic_string_view<C, Traits> input, Sink & output)
+  {
+    detail::serialize_length(input.size(), output);
+    detail::serialize_span(input.data(), input.size(), output);
+  }
+
+  template <typename C, typename Traits, typename Alloc, typename Sink>
+  void serialize(std::basic_string<C, Traits, Alloc> const & input, Sink & output)
+  {
+    serialize(std::basic_string_view<C, Traits>(input), output);
+  }
+
+  template <typename T, typename Alloc, typename Sink>
+  void serialize(std::vector<T, Alloc> const & input, Sink & output)
+  {
+    detail::serialize_length(input.size(), output);
+    if constexpr (std::is_same<T, bool>::value)
+      {
+        for (bool b : input) serialize(b, output);
+      }
+    else
+      {
+        detail::serialize_span(input.data(), input.size(), output);
+      }
+  }
+
+  template <typename A, typename B, typename Sink>
+  constexpr void serialize(std::pair<A, B> const & input, Sink & output)
+  {
+    serialize(input.first, output);
+    serialize(input.second, output);
+  }
+
+  template <typename ... Ts, typename Sink>
+  constexpr void serialize(std::tuple<Ts...> const & input, Sink & output)
+  {
+    std::apply([&](auto const & ... xs) { (serialize(xs, output), ...); }, input);
+  }
+
+
+  // Hashes the canonical serialization of `values` in order.
+  template <typename Hasher, typename ... Ts>
+  auto hash_serialized(Ts const & ... values)
+  {
+    Hasher h;
+    {
+      serial_sink<Hasher> sink(h);
+      (serialize(values, sink), ...);
+    }
+    return h.finalize();
+  }
+
+
+  namespace detail
+  {
+    // Sink that keeps what is written, for the checks below.
+    template <size_t N>
+    struct serial_record
+    {
+      uint8_t bytes[N] = {};
+      size_t size = 0;
+
+      constexpr void write(uint8_t const * data, size_t len)
+      {
+        for (size_t i = 0; i < len; i++) bytes[size++] = data[i];
+      }
+    };
+
+    template <size_t N, typename ... Ts>
+    constexpr bool serializes_to(uint8_t const (&expected)[N], Ts const & ... values)
+    {
+      serial_record<N> out;
+      (serialize(values, out), ...);
+      if (out.size != N) return false;
+      for (size_t i = 0; i < N; i++) if (out.bytes[i] != expected[i]) return false;
+      return true;
+    }
+
+    enum class serial_test_enum : uint16_t { value = 0x0102 };
+    static constexpr char const serial_test_string[] = "ab";
+
+    // Integers are little endian at their own width, signed ones as two's
+    // complement.
+    static_assert(serializes_to({ 0x04, 0x03, 0x02, 0x01 }, uint32_t(0x01020304)));
+    static_assert(serializes_to({ 0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01 }, uint64_t(0x0102030405060708)));
+    static_assert(serializes_to({ 0xfe, 0xff }, int16_t(-2)));
+    static_assert(serializes_to({ 0xff }, int8_t(-1)));
+
+    // bool is one byte, enums take the width of their underlying type.
+    static_assert(serializes_to({ 0x01, 0x00 }, true, false));
+    static_assert(serializes_to({ 0x02, 0x01 }, serial_test_enum::value));
+
+    // Strings carry a u64 element count; fixed size arrays do not.
+    static_assert(serializes_to({ 0x02, 0, 0, 0, 0, 0, 0, 0, 'a', 'b' }, std::string_view(serial_test_string)));
+    static_assert(serializes_to({ 0, 0, 0, 0, 0, 0, 0, 0 }, std::string_view()));
+    static_assert(serializes_to({ 0x02, 0x01, 0x04, 0x03 }, std::array<uint16_t, 2>{ 0x0102, 0x0304 }));
+    static_assert(serializes_to({ 0x01, 0x01, 0x04, 0x03, 0x05 }, std::make_tuple(uint8_t(1), true, uint16_t(0x0304)), std::make_pair(uint8_t(5), std::array<uint8_t, 0>{})));
+
+    // Where serialize_span writes an array as one span, its bytes in memory
+    // must be the per-element encoding.
+    template <typename T, size_t N>
+    constexpr bool raw_span_matches(std::array<T, N> const & values)
+    {
+      if constexpr (raw_serializable<T>)
+        {
+          auto image = __builtin_bit_cast(std::array<uint8_t, sizeof(T) * N>, values);
+          serial_record<sizeof(T) * N> out;
+          for (T const & v : values) serialize(v, out);
+          for (size_t i = 0; i < out.size; i++) if (out.bytes[i] != image[i]) return false;
+        }
+      return true;
+    }
+
+    static_assert(raw_span_matches(std::array<uint16_t, 2>{ 0x0102, 0xfffe }));
+    static_assert(raw_span_matches(std::array<int32_t, 2>{ 0x01020304, -2 }));
+    static_assert(raw_span_matches(std::array<uint64_t, 1>{ 0x0102030405060708 }));
+    static_assert(raw_span_matches(std::array<char, 3>{ 'a', '\0', char(0x80) }));
+    static_assert(!raw_serializable<bool> && !raw_serializable<serial_test_enum>);
+  }
+}
+
+#endif
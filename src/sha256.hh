@@ -15,9 +15,10 @@
 #define LIBIEV_HASH_SHA256_HH
 
 
-//#include <iev/serialize.hh>
-// TODO: Add serial support after new array type.
+#include <inttypes.h>
 #include <iterator>
+#include <type_traits>
+#include <utility>
 
 namespace iev
 {
@@ -51,7 +52,9 @@ namespace iev
 	  }
       }
 
-      template <typename ... Ts>
+      // Byte list constructor. Needs at least two arguments so it never
+      // hides the copy constructor for non-const lvalues.
+      template <typename ... Ts, typename = typename std::enable_if<(sizeof...(Ts) > 1)>::type>
       constexpr sum (Ts && ... ts) 
 	: data_{uint8_t(std::forward<Ts>(ts))...}
       {
@@ -99,11 +102,24 @@ namespace iev
       
       
     };
-  private:
+
+    // Shared with other SHA-256 implementations in this library.
+    constexpr uint32_t round_constants[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    constexpr uint32_t initial_state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
     class calculator
     {
       using ua64_t = uint32_t[64];
-      ua64_t __attribute__((__aligned__(64)))  k;
       using ua8_t = uint32_t[8]; ;
       ua8_t __attribute__((__aligned__(64))) hh;
       ua64_t __attribute__((__aligned__(64))) w;
@@ -116,15 +132,7 @@ namespace iev
     public:
 
       constexpr calculator() noexcept
-	: k{ 0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-	  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-	  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-	  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-	  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-	  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-	  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-	  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 },
-	hh{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+	: hh{ initial_state[0], initial_state[1], initial_state[2], initial_state[3], initial_state[4], initial_state[5], initial_state[6], initial_state[7] },
 	w { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0}, pos(0), z(0)
       {
 		
@@ -202,7 +210,7 @@ namespace iev
 	  {
 	    uint32_t S1 = rightrotate(aa[4], 6) xor rightrotate(aa[4], 11) xor rightrotate(aa[4], 25);
 	    uint32_t ch = (aa[4] bitand aa[5]) xor ((~aa[4]) bitand aa[6]);
-	    uint32_t temp1 = aa[7] + S1 + ch + k[i] + w[i];
+	    uint32_t temp1 = aa[7] + S1 + ch + round_constants[i] + w[i];
 	    uint32_t S0 = rightrotate(aa[0], 2) xor rightrotate(aa[0], 13) xor rightrotate(aa[0], 22);
 	    uint32_t maj = (aa[0] bitand aa[1]) xor (aa[0] bitand aa[2]) xor (aa[1] bitand aa[2]);
 	    uint32_t temp2 = S0 + maj;
@@ -243,7 +251,6 @@ namespace iev
       
 
     };
-  public:
 
     template <typename It>
     constexpr sum calculate(It begin, It end)
@@ -270,36 +277,57 @@ namespace iev
       return c.get();
     }
 
-  }
-  /*
-  template <typename It>
-  void serialize(sha256::sum const & input, It && output)
-  {
-    for(auto it = input.begin(); it != input.end(); it++)
+    class incremental_hasher
+    {
+      calculator c;
+
+    public:
+      static constexpr size_t block_size = 64;
+
+      constexpr incremental_hasher() noexcept
       {
-	iev::serialize(*it, output);
       }
+
+      constexpr void update(uint8_t const * data, size_t datalen) noexcept
+      {
+	c.process_bytes(data, data + datalen);
+      }
+
+      constexpr sum finalize() noexcept
+      {
+	c.finalize();
+	return c.get();
+      }
+    };
+
   }
-  
-  template <typename It>
-  void deserialize(sha256::sum & output, It && input)
+
+  namespace sha256
   {
-    for (auto &x: output) deserialize(x, input);
+    // Serialization hook, see serialize.hh. A digest serializes as its bytes.
+    template <typename Sink>
+    void serialize(sum const & input, Sink & output)
+    {
+      output.write(&*input.begin(), input.size());
+    }
   }
-  */
 
 
 
-  inline constexpr iev::sha256::sum operator "" _sha256 ( char const * data, uint64_t length)
+  namespace detail
   {
-    
-    constexpr uint8_t hex_value(char c)
+    inline constexpr uint8_t hex_value(char c)
     {
       if (c >= '0' && c <= '9') return c-'0';
       if (c >= 'a' && c <= 'z') return c-'a'+10;
-      if (c >= 'A' && c <= 'Z') return c-'a'+10;
+      if (c >= 'A' && c <= 'Z') return c-'A'+10;
       return 0;
     }
+  }
+
+  inline constexpr iev::sha256::sum operator "" _sha256 ( char const * data, size_t length)
+  {
+    using detail::hex_value;
     //    static_assert(length == 256/8);
     iev::sha256::sum output;
     for (int i = 0; i < output.size(); i++)
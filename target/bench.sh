@@ -0,0 +1,12 @@
+#!/bin/bash
+# Builds the benchmarks in bench/ into build/bench and runs them.
+BENCHDIR="./build/bench"
+mkdir -p $BENCHDIR
+for SOURCE in ./bench/*.cc; do
+    NAME=$(basename $SOURCE .cc)
+    ${CXX:-g++} -std=c++17 -O2 -pthread -I./src -o $BENCHDIR/$NAME $SOURCE -lsodium || exit 1
+done
+for BENCH in $BENCHDIR/*; do
+    echo "== $(basename $BENCH)"
+    $BENCH
+done
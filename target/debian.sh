@@ -7,13 +7,17 @@ BUILDDIR="./build/${PACKAGE_FULLNAME}"
 #echo $BUILDDIR
 
 mkdir -p $BUILDDIR/usr/include/iev
-cp ./src/blake2b.hh $BUILDDIR/usr/include/iev/blake2b
-cp ./src/sha512.hh $BUILDDIR/usr/include/iev/sha512
-cp ./src/sha256.hh $BUILDDIR/usr/include/iev/sha256
+# Headers install without their extension, so rewrite in-tree includes to match.
+for HEADER in ./src/*.hh; do
+    sed 's|^#include "\(.*\)\.hh"|#include <iev/\1>|' $HEADER > $BUILDDIR/usr/include/iev/$(basename $HEADER .hh)
+done
+mkdir -p $BUILDDIR/usr/bin
+${CXX:-g++} -std=c++17 -O2 -pthread -o $BUILDDIR/usr/bin/iev-hashsum ./src/iev-hashsum.cc -lsodium || exit 1
 mkdir -p $BUILDDIR/DEBIAN/
-printf "Package: ${PACKAGE_NAME}\nVersion: ${PACKAGE_VERSION}\nSection: base\nPriority: Optional\nArchitecture: all\nDepends:\nDescription: LibIEV Hash Functions
+printf "Package: ${PACKAGE_NAME}\nVersion: ${PACKAGE_VERSION}\nSection: base\nPriority: Optional\nArchitecture: $(dpkg --print-architecture)\nDepends: libsodium23\nDescription: LibIEV Hash Functions
  Contians: Blake2b
- Depends on libsodium\n" > $BUILDDIR/DEBIAN/control
+ Depends on libsodium
+ Includes iev-hashsum, a parallel sha256sum/sha512sum/b2sum\n" > $BUILDDIR/DEBIAN/control
 OLDDIR = "$(pwd)"
 cd build/
 dpkg-deb --build $PACKAGE_FULLNAME